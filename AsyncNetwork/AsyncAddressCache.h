@@ -0,0 +1,64 @@
+/**
+ * Copyright (C) 2011 Jonathan Diehl
+ * 
+ * Permission is hereby granted, free of charge, to any person obtaining a copy of
+ * this software and associated documentation files (the "Software"), to deal in
+ * the Software without restriction, including without limitation the rights to
+ * use, copy, modify, merge, publish, distribute, sublicense, and/or sell copies
+ * of the Software, and to permit persons to whom the Software is furnished to do
+ * so, subject to the following conditions:
+ * 
+ * The above copyright notice and this permission notice shall be included in all
+ * copies or substantial portions of the Software.
+ * 
+ * THE SOFTWARE IS PROVIDED "AS IS", WITHOUT WARRANTY OF ANY KIND, EXPRESS OR
+ * IMPLIED, INCLUDING BUT NOT LIMITED TO THE WARRANTIES OF MERCHANTABILITY,
+ * FITNESS FOR A PARTICULAR PURPOSE AND NONINFRINGEMENT. IN NO EVENT SHALL THE
+ * AUTHORS OR COPYRIGHT HOLDERS BE LIABLE FOR ANY CLAIM, DAMAGES OR OTHER
+ * LIABILITY, WHETHER IN AN ACTION OF CONTRACT, TORT OR OTHERWISE, ARISING FROM,
+ * OUT OF OR IN CONNECTION WITH THE SOFTWARE OR THE USE OR OTHER DEALINGS IN THE
+ * SOFTWARE.
+ * 
+ * https://github.com/jdiehl/async-network
+ */
+
+#import <Foundation/Foundation.h>
+
+/// called with the resolved socket addresses (NSData with a struct sockaddr) or an error
+typedef void (^AsyncAddressCacheBlock)(NSArray *addresses, NSError *error);
+
+/**
+ @brief A cache of the socket addresses that hosts and net services resolved to
+ @details Addresses are kept for timeToLive. Addresses that are used after refreshThreshold of their time to
+ live are resolved again in the background, so busy endpoints never wait for a lookup. Concurrent lookups of
+ the same host are done once. Connections invalidate the addresses of an endpoint they failed to connect to.
+ Net services are resolved on the main run loop. The cache is thread-safe.
+ */
+@interface AsyncAddressCache : NSObject <NSNetServiceDelegate>
+
+@property (assign) NSTimeInterval timeToLive;  // resolved addresses expire after this time
+@property (assign) double refreshThreshold;    // part (0-1) of the time to live after which used addresses are refreshed
+@property (readonly) NSUInteger count;         // endpoints with cached addresses
+
+// the cache used by connections by default
++ (AsyncAddressCache *)sharedCache;
+
+// cached addresses (nil if they are unknown or expired)
+- (NSArray *)addressesForHost:(NSString *)host port:(NSUInteger)port;
+- (NSArray *)addressesForNetService:(NSNetService *)netService;
+
+// cached addresses or the result of a background lookup (the block is called on any queue)
+- (void)resolveHost:(NSString *)host port:(NSUInteger)port completionBlock:(AsyncAddressCacheBlock)block;
+
+- (void)setAddresses:(NSArray *)addresses forHost:(NSString *)host port:(NSUInteger)port;
+- (void)setAddresses:(NSArray *)addresses forNetService:(NSNetService *)netService;
+
+// resolve an endpoint in the background unless its addresses are cached
+- (void)prewarmHost:(NSString *)host port:(NSUInteger)port;
+- (void)prewarmNetService:(NSNetService *)netService;
+
+- (void)invalidateHost:(NSString *)host port:(NSUInteger)port;
+- (void)invalidateNetService:(NSNetService *)netService;
+- (void)removeAllAddresses;
+
+@end
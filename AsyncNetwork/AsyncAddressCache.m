@@ -0,0 +1,329 @@
+/**
+ * Copyright (C) 2011 Jonathan Diehl
+ * 
+ * Permission is hereby granted, free of charge, to any person obtaining a copy of
+ * this software and associated documentation files (the "Software"), to deal in
+ * the Software without restriction, including without limitation the rights to
+ * use, copy, modify, merge, publish, distribute, sublicense, and/or sell copies
+ * of the Software, and to permit persons to whom the Software is furnished to do
+ * so, subject to the following conditions:
+ * 
+ * The above copyright notice and this permission notice shall be included in all
+ * copies or substantial portions of the Software.
+ * 
+ * THE SOFTWARE IS PROVIDED "AS IS", WITHOUT WARRANTY OF ANY KIND, EXPRESS OR
+ * IMPLIED, INCLUDING BUT NOT LIMITED TO THE WARRANTIES OF MERCHANTABILITY,
+ * FITNESS FOR A PARTICULAR PURPOSE AND NONINFRINGEMENT. IN NO EVENT SHALL THE
+ * AUTHORS OR COPYRIGHT HOLDERS BE LIABLE FOR ANY CLAIM, DAMAGES OR OTHER
+ * LIABILITY, WHETHER IN AN ACTION OF CONTRACT, TORT OR OTHERWISE, ARISING FROM,
+ * OUT OF OR IN CONNECTION WITH THE SOFTWARE OR THE USE OR OTHER DEALINGS IN THE
+ * SOFTWARE.
+ * 
+ * https://github.com/jdiehl/async-network
+ */
+
+#import "AsyncAddressCache.h"
+#import "AsyncNetworkHelpers.h"
+#import "GCDAsyncSocket.h"
+
+// the addresses of an endpoint
+@interface AsyncAddressCacheEntry : NSObject
+@property (strong) NSArray *addresses;
+@property (assign) CFAbsoluteTime resolvedTime;
+@property (assign) BOOL resolving;                // a lookup is running
+@property (strong) NSMutableArray *waitingBlocks; // called once the lookup finished
+@end
+
+@implementation AsyncAddressCacheEntry
+@synthesize addresses = _addresses;
+@synthesize resolvedTime = _resolvedTime;
+@synthesize resolving = _resolving;
+@synthesize waitingBlocks = _waitingBlocks;
+@end
+
+
+// private methods
+@interface AsyncAddressCache () {
+	NSMutableDictionary *_entries;           // endpoint -> entry
+	NSMutableSet *_resolvingServices;        // net services resolving on the main thread
+}
+- (NSString *)endpointForHost:(NSString *)host port:(NSUInteger)port;
+- (NSString *)endpointForNetService:(NSNetService *)netService;
+- (AsyncAddressCacheEntry *)entryForEndpoint:(NSString *)endpoint;
+- (NSArray *)addressesForEndpoint:(NSString *)endpoint refreshBlock:(dispatch_block_t)refreshBlock;
+- (void)setAddresses:(NSArray *)addresses forEndpoint:(NSString *)endpoint;
+- (void)lookupHost:(NSString *)host port:(NSUInteger)port completionBlock:(AsyncAddressCacheBlock)block;
+- (void)resolveNetService:(NSNetService *)netService;
+@end
+
+
+@implementation AsyncAddressCache
+
+@synthesize timeToLive = _timeToLive;
+@synthesize refreshThreshold = _refreshThreshold;
+
+// the cache used by connections by default
++ (AsyncAddressCache *)sharedCache;
+{
+	static AsyncAddressCache *cache = nil;
+	static dispatch_once_t once;
+	dispatch_once(&once, ^{ cache = [self new]; });
+	return cache;
+}
+
+// init
+- (id)init;
+{
+	self = [super init];
+	if (self) {
+		self.timeToLive = AsyncNetworkDefaultAddressCacheTimeToLive;
+		self.refreshThreshold = AsyncNetworkDefaultAddressCacheRefreshThreshold;
+		_entries = [NSMutableDictionary new];
+		_resolvingServices = [NSMutableSet new];
+	}
+	return self;
+}
+
+// debug description
+- (NSString *)description;
+{
+#ifdef __LP64__
+	return [NSString stringWithFormat:@"<%s endpoints=%ld>", object_getClassName(self), self.count];
+#else
+	return [NSString stringWithFormat:@"<%s endpoints=%d>", object_getClassName(self), self.count];
+#endif
+}
+
+
+#pragma mark - Custom Accessors
+
+// endpoints with cached addresses
+- (NSUInteger)count;
+{
+	@synchronized(self) {
+		NSUInteger count = 0;
+		for (AsyncAddressCacheEntry *entry in [_entries allValues]) {
+			if (entry.addresses) count++;
+		}
+		return count;
+	}
+}
+
+
+#pragma mark - Control Methods
+
+// cached addresses of a host
+- (NSArray *)addressesForHost:(NSString *)host port:(NSUInteger)port;
+{
+	if (!host) return nil;
+	return [self addressesForEndpoint:[self endpointForHost:host port:port] refreshBlock:^{
+		[self lookupHost:host port:port completionBlock:nil];
+	}];
+}
+
+// cached addresses of a net service
+- (NSArray *)addressesForNetService:(NSNetService *)netService;
+{
+	if (!netService) return nil;
+	return [self addressesForEndpoint:[self endpointForNetService:netService] refreshBlock:^{
+		[self resolveNetService:netService];
+	}];
+}
+
+// cached addresses or the result of a background lookup
+- (void)resolveHost:(NSString *)host port:(NSUInteger)port completionBlock:(AsyncAddressCacheBlock)block;
+{
+	NSArray *addresses = [self addressesForHost:host port:port];
+	if (addresses) {
+		if (block) block(addresses, nil);
+		return;
+	}
+	[self lookupHost:host port:port completionBlock:block];
+}
+
+// store the addresses of a host
+- (void)setAddresses:(NSArray *)addresses forHost:(NSString *)host port:(NSUInteger)port;
+{
+	[self setAddresses:addresses forEndpoint:[self endpointForHost:host port:port]];
+}
+
+// store the addresses of a resolved net service
+- (void)setAddresses:(NSArray *)addresses forNetService:(NSNetService *)netService;
+{
+	[self setAddresses:addresses forEndpoint:[self endpointForNetService:netService]];
+}
+
+// look up a host unless its addresses are cached
+- (void)prewarmHost:(NSString *)host port:(NSUInteger)port;
+{
+	[self resolveHost:host port:port completionBlock:nil];
+}
+
+// resolve a net service unless its addresses are cached
+- (void)prewarmNetService:(NSNetService *)netService;
+{
+	if ([self addressesForNetService:netService]) return;
+	[self resolveNetService:netService];
+}
+
+// forget the addresses of a host
+- (void)invalidateHost:(NSString *)host port:(NSUInteger)port;
+{
+	@synchronized(self) {
+		[_entries removeObjectForKey:[self endpointForHost:host port:port]];
+	}
+}
+
+// forget the addresses of a net service
+- (void)invalidateNetService:(NSNetService *)netService;
+{
+	@synchronized(self) {
+		[_entries removeObjectForKey:[self endpointForNetService:netService]];
+	}
+}
+
+// forget all addresses
+- (void)removeAllAddresses;
+{
+	@synchronized(self) {
+		[_entries removeAllObjects];
+	}
+}
+
+
+#pragma mark - Private Methods
+
+// key of a host
+- (NSString *)endpointForHost:(NSString *)host port:(NSUInteger)port;
+{
+	return [NSString stringWithFormat:@"%@:%lu", host, (unsigned long)port];
+}
+
+// key of a net service
+- (NSString *)endpointForNetService:(NSNetService *)netService;
+{
+	return [NSString stringWithFormat:@"%@.%@%@", netService.name, netService.type, netService.domain];
+}
+
+// the entry of an endpoint (access it @synchronized)
+- (AsyncAddressCacheEntry *)entryForEndpoint:(NSString *)endpoint;
+{
+	AsyncAddressCacheEntry *entry = [_entries objectForKey:endpoint];
+	if (!entry) {
+		entry = [AsyncAddressCacheEntry new];
+		entry.waitingBlocks = [NSMutableArray new];
+		[_entries setObject:entry forKey:endpoint];
+	}
+	return entry;
+}
+
+// addresses that did not expire (refreshed in the background once they are old)
+- (NSArray *)addressesForEndpoint:(NSString *)endpoint refreshBlock:(dispatch_block_t)refreshBlock;
+{
+	NSArray *addresses;
+	BOOL refresh;
+	@synchronized(self) {
+		AsyncAddressCacheEntry *entry = [_entries objectForKey:endpoint];
+		if (!entry.addresses) return nil;
+		NSTimeInterval age = CFAbsoluteTimeGetCurrent() - entry.resolvedTime;
+		if (age >= self.timeToLive) return nil;
+		addresses = entry.addresses;
+		refresh = !entry.resolving && age >= self.timeToLive * self.refreshThreshold;
+	}
+	if (refresh) refreshBlock();
+	return addresses;
+}
+
+// store addresses
+- (void)setAddresses:(NSArray *)addresses forEndpoint:(NSString *)endpoint;
+{
+	if (addresses.count == 0) return;
+	@synchronized(self) {
+		AsyncAddressCacheEntry *entry = [self entryForEndpoint:endpoint];
+		entry.addresses = [addresses copy];
+		entry.resolvedTime = CFAbsoluteTimeGetCurrent();
+	}
+}
+
+// look up a host in the background (once for all concurrent callers)
+- (void)lookupHost:(NSString *)host port:(NSUInteger)port completionBlock:(AsyncAddressCacheBlock)block;
+{
+	NSString *endpoint = [self endpointForHost:host port:port];
+	AsyncAddressCacheEntry *entry;
+	@synchronized(self) {
+		entry = [self entryForEndpoint:endpoint];
+		if (block) [entry.waitingBlocks addObject:[block copy]];
+		if (entry.resolving) return;
+		entry.resolving = YES;
+	}
+	
+	dispatch_async(dispatch_get_global_queue(DISPATCH_QUEUE_PRIORITY_DEFAULT, 0), ^{
+		NSError *error = nil;
+		NSArray *addresses = [GCDAsyncSocket lookupHost:host port:(uint16_t)port error:&error];
+		NSArray *waitingBlocks;
+		@synchronized(self) {
+			// the entry may have been invalidated in the meantime
+			entry.resolving = NO;
+			if (addresses.count > 0 && [_entries objectForKey:endpoint] == entry) {
+				entry.addresses = [addresses copy];
+				entry.resolvedTime = CFAbsoluteTimeGetCurrent();
+			} else if (!entry.addresses && [_entries objectForKey:endpoint] == entry) {
+				[_entries removeObjectForKey:endpoint];
+			}
+			waitingBlocks = [entry.waitingBlocks copy];
+			[entry.waitingBlocks removeAllObjects];
+		}
+		if (addresses.count == 0) addresses = nil;
+		for (AsyncAddressCacheBlock waitingBlock in waitingBlocks) {
+			waitingBlock(addresses, addresses ? nil : error);
+		}
+	});
+}
+
+// resolve a net service on the main run loop
+- (void)resolveNetService:(NSNetService *)netService;
+{
+	@synchronized(self) {
+		AsyncAddressCacheEntry *entry = [self entryForEndpoint:[self endpointForNetService:netService]];
+		if (entry.resolving) return;
+		entry.resolving = YES;
+	}
+	
+	// resolve a copy so that we do not replace the delegate of the caller's net service
+	NSString *domain = netService.domain, *type = netService.type, *name = netService.name;
+	dispatch_async(dispatch_get_main_queue(), ^{
+		NSNetService *service = [[NSNetService alloc] initWithDomain:domain type:type name:name];
+		service.delegate = self;
+		[_resolvingServices addObject:service];
+		[service resolveWithTimeout:AsyncNetworkDefaultResolveTimeout];
+	});
+}
+
+
+#pragma mark - NSNetServiceDelegate
+
+// store the addresses of a resolved net service
+- (void)netServiceDidResolveAddress:(NSNetService *)sender;
+{
+	sender.delegate = nil;
+	[_resolvingServices removeObject:sender];
+	@synchronized(self) {
+		[[_entries objectForKey:[self endpointForNetService:sender]] setResolving:NO];
+	}
+	[self setAddresses:sender.addresses forNetService:sender];
+}
+
+// the net service could not be resolved (it is resolved again on the next use)
+- (void)netService:(NSNetService *)sender didNotResolve:(NSDictionary *)errorDict;
+{
+	sender.delegate = nil;
+	[_resolvingServices removeObject:sender];
+	@synchronized(self) {
+		NSString *endpoint = [self endpointForNetService:sender];
+		AsyncAddressCacheEntry *entry = [_entries objectForKey:endpoint];
+		entry.resolving = NO;
+		if (!entry.addresses) [_entries removeObjectForKey:endpoint];
+	}
+}
+
+@end
@@ -47,6 +47,7 @@
 @property (readonly) GCDAsyncUdpSocket *broadcastSocket;
 
 @property (unsafe_unretained) id<AsyncBroadcasterDelegate> delegate;
+@property (strong, nonatomic) dispatch_queue_t delegateQueue; // queue for socket and delegate callbacks (default: AsyncNetworkDispatchQueue())
 @property (assign) NSTimeInterval timeout;      // timeout for sending broadcasts, 0 = disabled
 @property (strong, nonatomic) NSString *subnet; // default: 255.255.255.255
 @property (assign) NSUInteger port;             // must be set to a number > 0
@@ -37,6 +37,7 @@
 @synthesize listenSocket = _listenSocket;
 @synthesize broadcastSocket = _broadcastSocket;
 @synthesize delegate = _delegate;
+@synthesize delegateQueue = _delegateQueue;
 @synthesize timeout = _timeout;
 @synthesize subnet = _subnet;
 @synthesize port = _port;
@@ -71,6 +72,15 @@
 }
 
 
+#pragma mark - Custom Accessors
+
+// the delegate queue defaults to the global AsyncNetwork queue
+- (dispatch_queue_t)delegateQueue;
+{
+	return _delegateQueue ? _delegateQueue : AsyncNetworkDispatchQueue();
+}
+
+
 #pragma mark - Control Methods
 
 // open listener and broadcast sockets
@@ -121,7 +131,7 @@
 	if (self.listenSocket) return YES;
 	
 	// set up the udp socket
-	_listenSocket = [[GCDAsyncUdpSocket alloc] initWithDelegate:self delegateQueue:AsyncNetworkDispatchQueue()];
+	_listenSocket = [[GCDAsyncUdpSocket alloc] initWithDelegate:self delegateQueue:self.delegateQueue];
 	[self.listenSocket setIPv6Enabled:NO];
 	
 	// bind to port
@@ -151,7 +161,7 @@
 	if (self.broadcastSocket) return YES;
 
 	// set up the udp socket
-	_broadcastSocket = [[GCDAsyncUdpSocket alloc] initWithDelegate:self delegateQueue:AsyncNetworkDispatchQueue()];
+	_broadcastSocket = [[GCDAsyncUdpSocket alloc] initWithDelegate:self delegateQueue:self.delegateQueue];
 	[self.broadcastSocket setIPv6Enabled:NO];
 	
 	// enable broadcasting
@@ -25,6 +25,7 @@
 #import <Foundation/Foundation.h>
 
 #import "AsyncConnection.h"
+#import "AsyncHedgingPolicy.h"
 
 @class AsyncClient;
 
@@ -39,7 +40,10 @@
 - (void)client:(AsyncClient *)theClient didDisconnect:(AsyncConnection *)connection;
 - (void)client:(AsyncClient *)theClient didReceiveCommand:(AsyncCommand)command object:(id)object connection:(AsyncConnection *)connection;
 - (void)client:(AsyncClient *)theClient didReceiveCommand:(AsyncCommand)command object:(id)object connection:(AsyncConnection *)connection responseBlock:(AsyncNetworkResponseBlock)block;
+- (void)client:(AsyncClient *)theClient didReceiveChunk:(NSData *)chunk forCommand:(AsyncCommand)command stream:(UInt32)streamID finished:(BOOL)finished connection:(AsyncConnection *)connection;
 - (void)client:(AsyncClient *)theClient didFailWithError:(NSError *)error;
+- (void)client:(AsyncClient *)theClient didReachHighWatermark:(AsyncConnection *)connection;
+- (void)client:(AsyncClient *)theClient didDrainToLowWatermark:(AsyncConnection *)connection;
 
 @end
 
@@ -51,18 +55,61 @@
 @property (readonly) NSMutableSet *connections; // the discovered connections, observable, do not change!
 
 @property (unsafe_unretained) id<AsyncClientDelegate> delegate;
+@property (strong, nonatomic) dispatch_queue_t delegateQueue; // serial queue for connections and client state (default: AsyncNetworkDispatchQueue())
+
+// with connection queues each connection calls back on its own serial queue and connections are processed in parallel
+// call the client on its delegate queue, connection callbacks must not block on it
+@property (assign) BOOL connectionQueuesEnabled;            // give each new connection its own queue (default: NO)
+@property (strong) dispatch_queue_t connectionTargetQueue;  // concurrent pool the connection queues target (default: global queue)
+
 @property (strong) NSString *serviceType;   // Bonjour service type
 @property (strong) NSString *serviceDomain; // Bonjour service domain
 @property (assign) BOOL autoConnect;        // should the client automatically connect to discovered servers?
 @property (assign) BOOL includesPeerToPeer; // should bluetooth peers be included?
+@property (strong) id<AsyncCodec> codec;    // codec for new connections and broadcasts (default: AsyncKeyedArchiverCodec)
+@property (assign) BOOL compressionEnabled; // compress large bodies on new connections (default: NO)
+@property (assign) NSUInteger compressionThreshold; // minimum body size for compression
+@property (assign) BOOL batchingEnabled;        // batch outgoing frames on new connections (default: NO)
+@property (assign) NSTimeInterval batchMaxDelay; // maximum delay of batched frames
+@property (assign) NSUInteger batchMaxBytes;     // maximum size of a batch
+@property (assign) NSUInteger writeHighWatermark;  // write queue size at which new connections apply the write policy
+@property (assign) NSUInteger writeLowWatermark;   // write queue size at which new connections report that the queue drained
+@property (assign) AsyncConnectionWritePolicy writePolicy; // write policy of new connections (default: queue)
+@property (assign) NSTimeInterval heartbeatInterval; // heartbeat interval of new connections (0: no heartbeat, default)
+@property (assign) NSUInteger maxMissedHeartbeats;   // new connections disconnect after this many unanswered pings
+@property (strong) AsyncHedgingPolicy *hedgingPolicy; // policy of requests to any server (default: hedge after the 95th percentile)
 
 - (void)start;
 - (void)stop;
+- (void)flush;
+
+// the priority applies to all current and future connections
+- (void)setPriority:(AsyncConnectionPriority)priority forCommand:(AsyncCommand)command;
+
+// subscriptions apply to all current and future connections (servers only publish matching topics to us)
+@property (readonly) NSSet *subscribedTopics;
+- (void)subscribeToTopic:(NSString *)topic;
+- (void)unsubscribeFromTopic:(NSString *)topic;
+
+// counters of all current and closed connections (times are summed up)
+- (AsyncConnectionCounters)counters;
+- (NSDictionary *)sentFramesByCommand;
+- (NSDictionary *)receivedFramesByCommand;
+- (NSDictionary *)latencyHistograms;
 
 - (void)connectToService:(NSNetService *)service;
 
+// the connected server with the lowest smoothed round trip time (requires heartbeats)
+- (AsyncConnection *)fastestConnection;
+
+// send a request to the fastest server and to the next fastest ones if the hedging policy allows it
+// the response block is called once with the first response (or an error if all servers failed)
+- (void)requestCommand:(AsyncCommand)command object:(id<NSCoding>)object responseBlock:(AsyncNetworkResponseBlock)block;
+
 - (void)sendCommand:(AsyncCommand)command object:(id<NSCoding>)object responseBlock:(AsyncNetworkResponseBlock)block;
 - (void)sendCommand:(AsyncCommand)command object:(id<NSCoding>)object;
 - (void)sendObject:(id<NSCoding>)object;
+- (void)sendCommand:(AsyncCommand)command data:(NSData *)data responseBlock:(AsyncNetworkResponseBlock)block;
+- (void)sendCommand:(AsyncCommand)command data:(NSData *)data;
 
 @end
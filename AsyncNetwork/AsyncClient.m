@@ -24,6 +24,18 @@
 
 #import "AsyncClient.h"
 #import "AsyncNetworkHelpers.h"
+#import "AsyncTrace.h"
+
+// private state
+@interface AsyncClient () {
+	NSMutableDictionary *_commandPriorities;
+	NSMutableSet *_subscribedTopics;
+	AsyncConnectionCounters _closedCounters;
+	NSMutableDictionary *_closedSentFramesByCommand;
+	NSMutableDictionary *_closedReceivedFramesByCommand;
+	NSMutableDictionary *_closedLatencyHistograms;
+}
+@end
 
 @implementation AsyncClient
 
@@ -31,10 +43,25 @@
 @synthesize services = _services;
 @synthesize connections = _connections;
 @synthesize delegate = _delegate;
+@synthesize delegateQueue = _delegateQueue;
+@synthesize connectionQueuesEnabled = _connectionQueuesEnabled;
+@synthesize connectionTargetQueue = _connectionTargetQueue;
 @synthesize serviceType = _serviceType;
 @synthesize serviceDomain = _serviceDomain;
 @synthesize autoConnect = _autoConnect;
 @synthesize includesPeerToPeer = _includesPeerToPeer;
+@synthesize codec = _codec;
+@synthesize compressionEnabled = _compressionEnabled;
+@synthesize compressionThreshold = _compressionThreshold;
+@synthesize batchingEnabled = _batchingEnabled;
+@synthesize batchMaxDelay = _batchMaxDelay;
+@synthesize batchMaxBytes = _batchMaxBytes;
+@synthesize writeHighWatermark = _writeHighWatermark;
+@synthesize writeLowWatermark = _writeLowWatermark;
+@synthesize writePolicy = _writePolicy;
+@synthesize heartbeatInterval = _heartbeatInterval;
+@synthesize maxMissedHeartbeats = _maxMissedHeartbeats;
+@synthesize hedgingPolicy = _hedgingPolicy;
 
 
 // init
@@ -46,8 +73,26 @@
 		self.autoConnect = YES;
 		self.serviceType = AsyncNetworkDefaultServiceType;
 		self.serviceDomain = AsyncNetworkDefaultServiceDomain;
+		self.codec = [AsyncKeyedArchiverCodec codec];
+		self.compressionEnabled = NO;
+		self.compressionThreshold = AsyncNetworkDefaultCompressionThreshold;
+		self.batchingEnabled = NO;
+		self.batchMaxDelay = 0.0;
+		self.batchMaxBytes = AsyncNetworkDefaultBatchMaxBytes;
+		self.writeHighWatermark = AsyncNetworkDefaultWriteHighWatermark;
+		self.writeLowWatermark = AsyncNetworkDefaultWriteLowWatermark;
+		self.writePolicy = AsyncConnectionWritePolicyQueue;
+		self.heartbeatInterval = 0.0;
+		self.maxMissedHeartbeats = AsyncNetworkDefaultMaxMissedHeartbeats;
+		self.connectionQueuesEnabled = NO;
+		_commandPriorities = [NSMutableDictionary new];
+		_subscribedTopics = [NSMutableSet new];
+		_closedSentFramesByCommand = [NSMutableDictionary new];
+		_closedReceivedFramesByCommand = [NSMutableDictionary new];
+		_closedLatencyHistograms = [NSMutableDictionary new];
 		_services = [NSMutableSet new];
 		_connections = [NSMutableSet new];
+		self.hedgingPolicy = [AsyncHedgingPolicy new];
 	}
 	return self;
 }
@@ -102,7 +147,9 @@
 	AsyncConnection *connection;
 	for (connection in self.connections) {
 		connection.delegate = nil;
-		[connection cancel];
+		[connection performBlock:^{
+			[connection cancel];
+		}];
 	}
 	[self.connections removeAllObjects];
 	[self.services removeAllObjects];
@@ -114,17 +161,215 @@
 	// the connection takes care of resovling the net service
 	AsyncConnection *connection = [AsyncConnection connectionWithNetService:service];
 	connection.delegate = self;
+	connection.delegateQueue = self.connectionQueuesEnabled ? AsyncNetworkCreateConnectionQueue(self.connectionTargetQueue) : self.delegateQueue;
+	connection.codec = self.codec;
+	connection.compressionEnabled = self.compressionEnabled;
+	connection.compressionThreshold = self.compressionThreshold;
+	connection.batchingEnabled = self.batchingEnabled;
+	connection.batchMaxDelay = self.batchMaxDelay;
+	connection.batchMaxBytes = self.batchMaxBytes;
+	connection.writeHighWatermark = self.writeHighWatermark;
+	connection.writeLowWatermark = self.writeLowWatermark;
+	connection.writePolicy = self.writePolicy;
+	connection.heartbeatInterval = self.heartbeatInterval;
+	connection.maxMissedHeartbeats = self.maxMissedHeartbeats;
+	for (NSNumber *command in _commandPriorities) {
+		[connection setPriority:[[_commandPriorities objectForKey:command] intValue] forCommand:command.unsignedIntValue];
+	}
+	for (NSString *topic in _subscribedTopics) {
+		[connection subscribeToTopic:topic];
+	}
 	[connection start];
 	[self.connections addObject:connection];
 }
 
+// the delegate queue defaults to the global AsyncNetwork queue
+- (dispatch_queue_t)delegateQueue;
+{
+	return _delegateQueue ? _delegateQueue : AsyncNetworkDispatchQueue();
+}
+
+// set the delegate queue (before starting the client)
+- (void)setDelegateQueue:(dispatch_queue_t)delegateQueue;
+{
+	if (delegateQueue) AsyncNetworkRegisterQueue(delegateQueue);
+	_delegateQueue = delegateQueue;
+}
+
+// the connected server with the lowest smoothed round trip time
+// connections without a measurement are only returned if no other connection is available
+- (AsyncConnection *)fastestConnection;
+{
+	AsyncConnection *fastest = nil;
+	for (AsyncConnection *connection in self.connections) {
+		if (![connection connected]) continue;
+		if (!fastest || fastest.roundTripTime == 0 || (connection.roundTripTime > 0 && connection.roundTripTime < fastest.roundTripTime)) {
+			fastest = connection;
+		}
+	}
+	return fastest;
+}
+
+// send a hedged request to the connected servers from the fastest to the slowest
+- (void)requestCommand:(AsyncCommand)command object:(id<NSCoding>)object responseBlock:(AsyncNetworkResponseBlock)block;
+{
+	NSMutableArray *connections = [NSMutableArray arrayWithCapacity:self.connections.count];
+	for (AsyncConnection *connection in self.connections) {
+		if ([connection connected]) [connections addObject:connection];
+	}
+	if (connections.count == 0) {
+		if (block) block([NSError errorWithDomain:AsyncNetworkErrorDomain code:AsyncNetworkErrorDisconnected userInfo:nil]);
+		return;
+	}
+	
+	// connections without a measurement go last
+	[connections sortUsingComparator:^NSComparisonResult(AsyncConnection *a, AsyncConnection *b) {
+		NSTimeInterval rttA = a.roundTripTime > 0 ? a.roundTripTime : DBL_MAX;
+		NSTimeInterval rttB = b.roundTripTime > 0 ? b.roundTripTime : DBL_MAX;
+		return rttA < rttB ? NSOrderedAscending : rttA > rttB ? NSOrderedDescending : NSOrderedSame;
+	}];
+	
+	// without a policy only the fastest server is asked
+	AsyncHedgingPolicy *policy = self.hedgingPolicy;
+	NSUInteger attempts = policy ? connections.count : 1;
+	if (!policy) policy = [AsyncHedgingPolicy policyWithDelay:0];
+	[policy performRequestWithCommand:command attempts:attempts attemptBlock:^dispatch_block_t(NSUInteger attempt, AsyncNetworkResponseBlock responseBlock) {
+		AsyncConnection *connection = [connections objectAtIndex:attempt];
+		__block UInt32 tag = 0;
+		__block BOOL cancelled = NO;
+		[connection performBlock:^{
+			if (cancelled) return;
+			if (![connection connected]) {
+				responseBlock([NSError errorWithDomain:AsyncNetworkErrorDomain code:AsyncNetworkErrorDisconnected userInfo:nil]);
+				return;
+			}
+			tag = [connection sendCommand:command object:object timeout:connection.requestTimeout responseBlock:responseBlock];
+		}];
+		return ^{
+			[connection performBlock:^{
+				cancelled = YES;
+				if (tag) [connection cancelRequestWithTag:tag];
+			}];
+		};
+	} responseBlock:block];
+}
+
+// write the batched frames of all connections
+- (void)flush;
+{
+	for (AsyncConnection *connection in self.connections) {
+		[connection performBlock:^{
+			[connection flush];
+		}];
+	}
+}
+
+// counters of all current and closed connections
+- (AsyncConnectionCounters)counters;
+{
+	__block AsyncConnectionCounters counters = _closedCounters;
+	for (AsyncConnection *connection in self.connections) {
+		[connection performBlockAndWait:^{
+			AsyncConnectionAddCounters(&counters, connection.counters);
+		}];
+	}
+	return counters;
+}
+
+// messages, requests and stream chunks sent by command on all current and closed connections
+- (NSDictionary *)sentFramesByCommand;
+{
+	NSMutableDictionary *counts = [_closedSentFramesByCommand mutableCopy];
+	for (AsyncConnection *connection in self.connections) {
+		[connection performBlockAndWait:^{
+			AsyncConnectionAddCommandCounts(counts, connection.sentFramesByCommand);
+		}];
+	}
+	return counts;
+}
+
+// messages, requests and stream chunks received by command on all current and closed connections
+- (NSDictionary *)receivedFramesByCommand;
+{
+	NSMutableDictionary *counts = [_closedReceivedFramesByCommand mutableCopy];
+	for (AsyncConnection *connection in self.connections) {
+		[connection performBlockAndWait:^{
+			AsyncConnectionAddCommandCounts(counts, connection.receivedFramesByCommand);
+		}];
+	}
+	return counts;
+}
+
+// round trip times by command on all current and closed connections
+- (NSDictionary *)latencyHistograms;
+{
+	NSMutableDictionary *histograms = [NSMutableDictionary dictionary];
+	[AsyncLatencyHistogram addHistograms:_closedLatencyHistograms toHistograms:histograms];
+	for (AsyncConnection *connection in self.connections) {
+		[connection performBlockAndWait:^{
+			[AsyncLatencyHistogram addHistograms:connection.latencyHistograms toHistograms:histograms];
+		}];
+	}
+	return histograms;
+}
+
+// set the priority lane of a command on all connections
+- (void)setPriority:(AsyncConnectionPriority)priority forCommand:(AsyncCommand)command;
+{
+	[_commandPriorities setObject:[NSNumber numberWithInt:priority] forKey:[NSNumber numberWithUnsignedInt:command]];
+	for (AsyncConnection *connection in self.connections) {
+		[connection performBlock:^{
+			[connection setPriority:priority forCommand:command];
+		}];
+	}
+}
+
+// topics we subscribed to
+- (NSSet *)subscribedTopics;
+{
+	return [_subscribedTopics copy];
+}
+
+// subscribe to a topic on all connections
+- (void)subscribeToTopic:(NSString *)topic;
+{
+	[_subscribedTopics addObject:topic];
+	for (AsyncConnection *connection in self.connections) {
+		[connection performBlock:^{
+			[connection subscribeToTopic:topic];
+		}];
+	}
+}
+
+// unsubscribe from a topic on all connections
+- (void)unsubscribeFromTopic:(NSString *)topic;
+{
+	[_subscribedTopics removeObject:topic];
+	for (AsyncConnection *connection in self.connections) {
+		[connection performBlock:^{
+			[connection unsubscribeFromTopic:topic];
+		}];
+	}
+}
+
 // send object to all servers
 - (void)sendCommand:(AsyncCommand)command object:(id<NSCoding>)object responseBlock:(AsyncNetworkResponseBlock)block;
 {
-	AsyncConnection *connection;
-	for (connection in self.connections) {
-		if(![connection connected]) continue;
-		[connection sendCommand:command object:object responseBlock:block];
+	// encode once and share the immutable body with all connections
+	NSData *body = nil;
+	AsyncCodecID codecID = 0;
+	if (object) {
+		id<AsyncCodec> codec = self.codec;
+		CFAbsoluteTime start = CFAbsoluteTimeGetCurrent();
+		body = [[codec encodeObject:object] copy];
+		AsyncTraceRecord("encode", (__bridge void *)self, command, 0, start, CFAbsoluteTimeGetCurrent());
+		codecID = codec.codecID;
+	}
+	
+	for (AsyncConnection *connection in self.connections) {
+		[connection performBlock:^{
+			if ([connection connected]) [connection sendCommand:command body:body codecID:codecID responseBlock:block];
+		}];
 	}
 }
 
@@ -140,6 +385,22 @@
 	[self sendCommand:0 object:object responseBlock:nil];
 }
 
+// send command and raw data with response block
+- (void)sendCommand:(AsyncCommand)command data:(NSData *)data responseBlock:(AsyncNetworkResponseBlock)block;
+{
+	for (AsyncConnection *connection in self.connections) {
+		[connection performBlock:^{
+			if ([connection connected]) [connection sendCommand:command data:data responseBlock:block];
+		}];
+	}
+}
+
+// send command and raw data without response block
+- (void)sendCommand:(AsyncCommand)command data:(NSData *)data;
+{
+	[self sendCommand:command data:data responseBlock:nil];
+}
+
 
 #pragma mark - NSNetServiceBrowserDelegate
 
@@ -156,16 +417,19 @@
 		connect = self.autoConnect;
 	}
 	
-	// connect to the net service
+	// connect to the net service or resolve it in the background for later
 	if (connect) {
 		[self connectToService:netService];
-	}	
+	} else {
+		[[AsyncAddressCache sharedCache] prewarmNetService:netService];
+	}
 }
 
 // service browser lost track of a service
 - (void)netServiceBrowser:(NSNetServiceBrowser *)aNetServiceBrowser didRemoveService:(NSNetService *)netService moreComing:(BOOL)moreComing;
 {
 	[self.services removeObject:netService];
+	[[AsyncAddressCache sharedCache] invalidateNetService:netService];
 	if ([self.delegate respondsToSelector:@selector(client:didRemoveService:)]) {
 		[self.delegate client:self didRemoveService:netService];
 	}
@@ -185,10 +449,28 @@
 // the connection was disconnected
 - (void)connectionDidDisconnect:(AsyncConnection *)theConnection;
 {
-	[self.connections removeObject:theConnection];
-	if ([self.delegate respondsToSelector:@selector(client:didDisconnect:)]) {
-		[self.delegate client:self didDisconnect:theConnection];
-	}
+	// keep the totals of closed connections (without gauges)
+	AsyncConnectionCounters counters = theConnection.counters;
+	counters.queuedWriteBytes = 0;
+	counters.queuedWriteFrames = 0;
+	counters.pendingRequests = 0;
+	counters.connections = 0;
+	NSDictionary *sentFramesByCommand = theConnection.sentFramesByCommand;
+	NSDictionary *receivedFramesByCommand = theConnection.receivedFramesByCommand;
+	NSDictionary *latencyHistograms = theConnection.latencyHistograms;
+	
+	// the connection may call back on its own queue
+	AsyncNetworkPerformBlock(self.delegateQueue, NO, ^{
+		AsyncConnectionAddCounters(&_closedCounters, counters);
+		AsyncConnectionAddCommandCounts(_closedSentFramesByCommand, sentFramesByCommand);
+		AsyncConnectionAddCommandCounts(_closedReceivedFramesByCommand, receivedFramesByCommand);
+		[AsyncLatencyHistogram addHistograms:latencyHistograms toHistograms:_closedLatencyHistograms];
+		
+		[self.connections removeObject:theConnection];
+		if ([self.delegate respondsToSelector:@selector(client:didDisconnect:)]) {
+			[self.delegate client:self didDisconnect:theConnection];
+		}
+	});
 }
 
 // incomding command
@@ -207,6 +489,30 @@
 	}
 }
 
+// incoming stream chunk
+- (void)connection:(AsyncConnection *)theConnection didReceiveChunk:(NSData *)chunk forCommand:(AsyncCommand)command stream:(UInt32)streamID finished:(BOOL)finished;
+{
+	if ([self.delegate respondsToSelector:@selector(client:didReceiveChunk:forCommand:stream:finished:connection:)]) {
+		[self.delegate client:self didReceiveChunk:chunk forCommand:command stream:streamID finished:finished connection:theConnection];
+	}
+}
+
+// the write queue of the connection is full
+- (void)connectionDidReachHighWatermark:(AsyncConnection *)theConnection;
+{
+	if ([self.delegate respondsToSelector:@selector(client:didReachHighWatermark:)]) {
+		[self.delegate client:self didReachHighWatermark:theConnection];
+	}
+}
+
+// the write queue of the connection drained
+- (void)connectionDidDrainToLowWatermark:(AsyncConnection *)theConnection;
+{
+	if ([self.delegate respondsToSelector:@selector(client:didDrainToLowWatermark:)]) {
+		[self.delegate client:self didDrainToLowWatermark:theConnection];
+	}
+}
+
 // the connection reported an error
 - (void)connection:(AsyncConnection *)theConnection didFailWithError:(NSError *)error;
 {
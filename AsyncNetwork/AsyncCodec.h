@@ -0,0 +1,67 @@
+/**
+ * Copyright (C) 2011 Jonathan Diehl
+ * 
+ * Permission is hereby granted, free of charge, to any person obtaining a copy of
+ * this software and associated documentation files (the "Software"), to deal in
+ * the Software without restriction, including without limitation the rights to
+ * use, copy, modify, merge, publish, distribute, sublicense, and/or sell copies
+ * of the Software, and to permit persons to whom the Software is furnished to do
+ * so, subject to the following conditions:
+ * 
+ * The above copyright notice and this permission notice shall be included in all
+ * copies or substantial portions of the Software.
+ * 
+ * THE SOFTWARE IS PROVIDED "AS IS", WITHOUT WARRANTY OF ANY KIND, EXPRESS OR
+ * IMPLIED, INCLUDING BUT NOT LIMITED TO THE WARRANTIES OF MERCHANTABILITY,
+ * FITNESS FOR A PARTICULAR PURPOSE AND NONINFRINGEMENT. IN NO EVENT SHALL THE
+ * AUTHORS OR COPYRIGHT HOLDERS BE LIABLE FOR ANY CLAIM, DAMAGES OR OTHER
+ * LIABILITY, WHETHER IN AN ACTION OF CONTRACT, TORT OR OTHERWISE, ARISING FROM,
+ * OUT OF OR IN CONNECTION WITH THE SOFTWARE OR THE USE OR OTHER DEALINGS IN THE
+ * SOFTWARE.
+ * 
+ * https://github.com/jdiehl/async-network
+ */
+
+#import <Foundation/Foundation.h>
+
+/// Identifies a codec on the wire (carried in every frame header)
+typedef UInt8 AsyncCodecID;
+
+/// NSKeyedArchiver codec (default, supports any NSCoding object)
+extern const AsyncCodecID AsyncCodecIDKeyedArchiver;
+
+/// Compact binary codec for NSData, NSString, NSNumber, NSArray, NSDictionary and NSNull
+extern const AsyncCodecID AsyncCodecIDBinary;
+
+/// Raw NSData bodies that are passed through without encoding (reserved, no codec object)
+extern const AsyncCodecID AsyncCodecIDRaw;
+
+/// A codec encodes message objects into frame bodies and decodes them again
+@protocol AsyncCodec <NSObject>
+
+@property (readonly) AsyncCodecID codecID;
+
+- (NSData *)encodeObject:(id)object; // raises NSInvalidArgumentException for unsupported objects
+- (id)decodeData:(NSData *)data;     // returns nil for malformed data
+
+@end
+
+/// Return the registered codec for the given id or nil
+extern id<AsyncCodec> AsyncCodecForID(AsyncCodecID codecID);
+
+/// Register a custom codec, the receiving side must register the same codec to decode its frames
+extern void AsyncRegisterCodec(id<AsyncCodec> codec);
+
+/// Codec based on NSKeyedArchiver and NSKeyedUnarchiver
+@interface AsyncKeyedArchiverCodec : NSObject <AsyncCodec>
+
++ (id)codec;
+
+@end
+
+/// Compact binary codec for property list like objects
+@interface AsyncBinaryCodec : NSObject <AsyncCodec>
+
++ (id)codec;
+
+@end
@@ -0,0 +1,313 @@
+/**
+ * Copyright (C) 2011 Jonathan Diehl
+ * 
+ * Permission is hereby granted, free of charge, to any person obtaining a copy of
+ * this software and associated documentation files (the "Software"), to deal in
+ * the Software without restriction, including without limitation the rights to
+ * use, copy, modify, merge, publish, distribute, sublicense, and/or sell copies
+ * of the Software, and to permit persons to whom the Software is furnished to do
+ * so, subject to the following conditions:
+ * 
+ * The above copyright notice and this permission notice shall be included in all
+ * copies or substantial portions of the Software.
+ * 
+ * THE SOFTWARE IS PROVIDED "AS IS", WITHOUT WARRANTY OF ANY KIND, EXPRESS OR
+ * IMPLIED, INCLUDING BUT NOT LIMITED TO THE WARRANTIES OF MERCHANTABILITY,
+ * FITNESS FOR A PARTICULAR PURPOSE AND NONINFRINGEMENT. IN NO EVENT SHALL THE
+ * AUTHORS OR COPYRIGHT HOLDERS BE LIABLE FOR ANY CLAIM, DAMAGES OR OTHER
+ * LIABILITY, WHETHER IN AN ACTION OF CONTRACT, TORT OR OTHERWISE, ARISING FROM,
+ * OUT OF OR IN CONNECTION WITH THE SOFTWARE OR THE USE OR OTHER DEALINGS IN THE
+ * SOFTWARE.
+ * 
+ * https://github.com/jdiehl/async-network
+ */
+
+#import "AsyncCodec.h"
+#import "AsyncNetworkHelpers.h"
+
+const AsyncCodecID AsyncCodecIDKeyedArchiver = 0;
+const AsyncCodecID AsyncCodecIDBinary = 1;
+const AsyncCodecID AsyncCodecIDRaw = 255;
+
+// binary codec value types
+enum {
+	AsyncBinaryTypeNull = 0,
+	AsyncBinaryTypeFalse = 1,
+	AsyncBinaryTypeTrue = 2,
+	AsyncBinaryTypeInteger = 3,  // zigzag varint
+	AsyncBinaryTypeUnsigned = 4, // varint
+	AsyncBinaryTypeDouble = 5,   // 8 bytes little endian
+	AsyncBinaryTypeString = 6,   // varint length + utf8
+	AsyncBinaryTypeData = 7,     // varint length + bytes
+	AsyncBinaryTypeArray = 8,    // varint count + values
+	AsyncBinaryTypeDictionary = 9 // varint count + key value pairs
+};
+
+// maximum nesting of arrays and dictionaries accepted by the decoder
+#define AsyncBinaryMaxDepth 64
+
+// registered codecs
+static id<AsyncCodec> _codecs[256];
+static dispatch_once_t _codecsOnce;
+
+// register the built-in codecs
+static void AsyncRegisterDefaultCodecs(void)
+{
+	dispatch_once(&_codecsOnce, ^{
+		_codecs[AsyncCodecIDKeyedArchiver] = [AsyncKeyedArchiverCodec codec];
+		_codecs[AsyncCodecIDBinary] = [AsyncBinaryCodec codec];
+	});
+}
+
+// return the codec for the given id
+id<AsyncCodec> AsyncCodecForID(AsyncCodecID codecID)
+{
+	AsyncRegisterDefaultCodecs();
+	return _codecs[codecID];
+}
+
+// register a custom codec
+void AsyncRegisterCodec(id<AsyncCodec> codec)
+{
+	NSCAssert(codec.codecID != AsyncCodecIDRaw, @"AsyncCodec: the raw codec id is reserved");
+	AsyncRegisterDefaultCodecs();
+	@synchronized([AsyncKeyedArchiverCodec class]) {
+		_codecs[codec.codecID] = codec;
+	}
+}
+
+
+#pragma mark - AsyncKeyedArchiverCodec
+
+@implementation AsyncKeyedArchiverCodec
+
+// shared instance
++ (id)codec;
+{
+	static AsyncKeyedArchiverCodec *codec = nil;
+	static dispatch_once_t once;
+	dispatch_once(&once, ^{ codec = [self new]; });
+	return codec;
+}
+
+- (AsyncCodecID)codecID;
+{
+	return AsyncCodecIDKeyedArchiver;
+}
+
+- (NSData *)encodeObject:(id)object;
+{
+	return [NSKeyedArchiver archivedDataWithRootObject:object];
+}
+
+- (id)decodeData:(NSData *)data;
+{
+	@try {
+		return [NSKeyedUnarchiver unarchiveObjectWithData:data];
+	}
+	@catch (NSException *exception) {
+		NSLog(@"AsyncKeyedArchiverCodec: could not decode data: %@", exception.reason);
+		return nil;
+	}
+}
+
+@end
+
+
+#pragma mark - AsyncBinaryCodec
+
+// encode a single value
+static void AsyncBinaryEncode(NSMutableData *data, id object)
+{
+	UInt8 type;
+	
+	// null
+	if (!object || object == [NSNull null]) {
+		type = AsyncBinaryTypeNull;
+		[data appendBytes:&type length:1];
+	}
+	
+	// string
+	else if ([object isKindOfClass:[NSString class]]) {
+		NSString *string = object;
+		NSUInteger length = [string lengthOfBytesUsingEncoding:NSUTF8StringEncoding];
+		type = AsyncBinaryTypeString;
+		[data appendBytes:&type length:1];
+		AsyncNetworkAppendVarint(data, length);
+		NSUInteger offset = data.length;
+		[data increaseLengthBy:length];
+		[string getBytes:(UInt8 *)data.mutableBytes + offset maxLength:length usedLength:NULL encoding:NSUTF8StringEncoding options:0 range:NSMakeRange(0, string.length) remainingRange:NULL];
+	}
+	
+	// number
+	else if ([object isKindOfClass:[NSNumber class]]) {
+		NSNumber *number = object;
+		const char *objCType = number.objCType;
+		if (CFGetTypeID((__bridge CFTypeRef)number) == CFBooleanGetTypeID()) {
+			type = number.boolValue ? AsyncBinaryTypeTrue : AsyncBinaryTypeFalse;
+			[data appendBytes:&type length:1];
+		} else if (objCType[0] == 'f' || objCType[0] == 'd') {
+			type = AsyncBinaryTypeDouble;
+			[data appendBytes:&type length:1];
+			double value = number.doubleValue;
+			UInt64 bits;
+			memcpy(&bits, &value, sizeof(bits));
+			bits = CFSwapInt64HostToLittle(bits);
+			[data appendBytes:&bits length:sizeof(bits)];
+		} else if (objCType[0] == 'Q' && number.unsignedLongLongValue > INT64_MAX) {
+			type = AsyncBinaryTypeUnsigned;
+			[data appendBytes:&type length:1];
+			AsyncNetworkAppendVarint(data, number.unsignedLongLongValue);
+		} else {
+			SInt64 value = number.longLongValue;
+			type = AsyncBinaryTypeInteger;
+			[data appendBytes:&type length:1];
+			AsyncNetworkAppendVarint(data, ((UInt64)value << 1) ^ (UInt64)(value >> 63));
+		}
+	}
+	
+	// data
+	else if ([object isKindOfClass:[NSData class]]) {
+		NSData *bytes = object;
+		type = AsyncBinaryTypeData;
+		[data appendBytes:&type length:1];
+		AsyncNetworkAppendVarint(data, bytes.length);
+		[data appendData:bytes];
+	}
+	
+	// array
+	else if ([object isKindOfClass:[NSArray class]]) {
+		NSArray *array = object;
+		type = AsyncBinaryTypeArray;
+		[data appendBytes:&type length:1];
+		AsyncNetworkAppendVarint(data, array.count);
+		for (id value in array) AsyncBinaryEncode(data, value);
+	}
+	
+	// dictionary
+	else if ([object isKindOfClass:[NSDictionary class]]) {
+		NSDictionary *dictionary = object;
+		type = AsyncBinaryTypeDictionary;
+		[data appendBytes:&type length:1];
+		AsyncNetworkAppendVarint(data, dictionary.count);
+		[dictionary enumerateKeysAndObjectsUsingBlock:^(id key, id value, BOOL *stop) {
+			AsyncBinaryEncode(data, key);
+			AsyncBinaryEncode(data, value);
+		}];
+	}
+	
+	else {
+		[NSException raise:NSInvalidArgumentException format:@"AsyncBinaryCodec: cannot encode object of class %@", [object class]];
+	}
+}
+
+// decode a single value, returns nil for malformed data
+static id AsyncBinaryDecode(const UInt8 *bytes, NSUInteger length, NSUInteger *offset, NSUInteger depth)
+{
+	if (*offset >= length || depth > AsyncBinaryMaxDepth) return nil;
+	UInt8 type = bytes[(*offset)++];
+	UInt64 value;
+	
+	switch (type) {
+		case AsyncBinaryTypeNull:
+			return [NSNull null];
+			
+		case AsyncBinaryTypeFalse:
+			return (__bridge id)kCFBooleanFalse;
+			
+		case AsyncBinaryTypeTrue:
+			return (__bridge id)kCFBooleanTrue;
+			
+		case AsyncBinaryTypeInteger:
+			if (!AsyncNetworkReadVarint(bytes, length, offset, &value)) return nil;
+			return [NSNumber numberWithLongLong:(SInt64)(value >> 1) ^ -(SInt64)(value & 1)];
+			
+		case AsyncBinaryTypeUnsigned:
+			if (!AsyncNetworkReadVarint(bytes, length, offset, &value)) return nil;
+			return [NSNumber numberWithUnsignedLongLong:value];
+			
+		case AsyncBinaryTypeDouble: {
+			if (length - *offset < sizeof(UInt64)) return nil;
+			double number;
+			memcpy(&value, bytes + *offset, sizeof(value));
+			value = CFSwapInt64LittleToHost(value);
+			memcpy(&number, &value, sizeof(number));
+			*offset += sizeof(value);
+			return [NSNumber numberWithDouble:number];
+		}
+			
+		case AsyncBinaryTypeString: {
+			if (!AsyncNetworkReadVarint(bytes, length, offset, &value) || value > length - *offset) return nil;
+			NSString *string = [[NSString alloc] initWithBytes:bytes + *offset length:(NSUInteger)value encoding:NSUTF8StringEncoding];
+			*offset += (NSUInteger)value;
+			return string;
+		}
+			
+		case AsyncBinaryTypeData: {
+			if (!AsyncNetworkReadVarint(bytes, length, offset, &value) || value > length - *offset) return nil;
+			NSData *data = [NSData dataWithBytes:bytes + *offset length:(NSUInteger)value];
+			*offset += (NSUInteger)value;
+			return data;
+		}
+			
+		case AsyncBinaryTypeArray: {
+			// every value takes at least one byte
+			if (!AsyncNetworkReadVarint(bytes, length, offset, &value) || value > length - *offset) return nil;
+			NSMutableArray *array = [NSMutableArray arrayWithCapacity:(NSUInteger)value];
+			for (UInt64 i = 0; i < value; i++) {
+				id item = AsyncBinaryDecode(bytes, length, offset, depth + 1);
+				if (!item) return nil;
+				[array addObject:item];
+			}
+			return array;
+		}
+			
+		case AsyncBinaryTypeDictionary: {
+			// every key value pair takes at least two bytes
+			if (!AsyncNetworkReadVarint(bytes, length, offset, &value) || value > (length - *offset) / 2) return nil;
+			NSMutableDictionary *dictionary = [NSMutableDictionary dictionaryWithCapacity:(NSUInteger)value];
+			for (UInt64 i = 0; i < value; i++) {
+				id key = AsyncBinaryDecode(bytes, length, offset, depth + 1);
+				id item = key ? AsyncBinaryDecode(bytes, length, offset, depth + 1) : nil;
+				if (!item) return nil;
+				[dictionary setObject:item forKey:key];
+			}
+			return dictionary;
+		}
+	}
+	
+	return nil;
+}
+
+@implementation AsyncBinaryCodec
+
+// shared instance
++ (id)codec;
+{
+	static AsyncBinaryCodec *codec = nil;
+	static dispatch_once_t once;
+	dispatch_once(&once, ^{ codec = [self new]; });
+	return codec;
+}
+
+- (AsyncCodecID)codecID;
+{
+	return AsyncCodecIDBinary;
+}
+
+- (NSData *)encodeObject:(id)object;
+{
+	NSMutableData *data = [NSMutableData dataWithCapacity:64];
+	AsyncBinaryEncode(data, object);
+	return data;
+}
+
+- (id)decodeData:(NSData *)data;
+{
+	NSUInteger offset = 0;
+	id object = AsyncBinaryDecode(data.bytes, data.length, &offset, 0);
+	if (offset != data.length) return nil;
+	return object;
+}
+
+@end
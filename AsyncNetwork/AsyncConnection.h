@@ -25,15 +25,57 @@
 #import <Foundation/Foundation.h>
 #import "GCDAsyncSocket.h"
 #import "AsyncNetworkHelpers.h"
+#import "AsyncCodec.h"
+#import "AsyncPendingRequests.h"
+#import "AsyncLatencyHistogram.h"
+#import "AsyncAddressCache.h"
 
 @class  AsyncConnection;
 
+/// Returns the next chunk of an outgoing stream or nil at the end of the stream
+typedef NSData *(^AsyncConnectionChunkProducer)(void);
+
 typedef UInt32 AsyncCommand;
+
+/// Performance counters of a connection (servers and clients add up the counters of their connections)
+typedef struct {
+	UInt64 messagesSent;          // messages, requests and responses
+	UInt64 messagesReceived;
+	UInt64 framesSent;            // frames on the wire (including control frames, stream chunks and fragments)
+	UInt64 framesReceived;
+	UInt64 bytesSent;             // bytes handed to the socket
+	UInt64 bytesReceived;         // bytes read from the socket
+	NSTimeInterval encodeTime;    // total time spent encoding objects
+	NSTimeInterval decodeTime;    // total time spent decoding objects
+	NSUInteger queuedWriteBytes;  // current write queue depth
+	NSUInteger queuedWriteFrames;
+	NSUInteger pendingRequests;   // requests waiting for a response
+	NSTimeInterval connectTime;   // time from start to the established connection (0 for accepted connections)
+	NSTimeInterval handshakeTime; // time from the established connection to the peer's hello
+	NSUInteger connections;       // number of open connections included in the counters
+} AsyncConnectionCounters;
+
+/// Priority lanes of outgoing frames (a response inherits the priority of its request)
+typedef enum {
+	AsyncConnectionPriorityNormal = 0, // default
+	AsyncConnectionPriorityHigh = 1,   // always written first (control messages)
+	AsyncConnectionPriorityLow = 2     // shares the connection with normal frames by weight (bulk transfers)
+} AsyncConnectionPriority;
+
+/// What happens to frames sent while the write queue is above the high watermark
+typedef enum {
+	AsyncConnectionWritePolicyQueue = 0,     // queue them anyway (default)
+	AsyncConnectionWritePolicyDrop = 1,      // drop them silently (requests fail with AsyncNetworkErrorWriteQueueFull)
+	AsyncConnectionWritePolicyFail = 2,      // drop them and report AsyncNetworkErrorWriteQueueFull to the delegate
+	AsyncConnectionWritePolicyDisconnect = 3 // close the connection
+} AsyncConnectionWritePolicy;
 typedef struct {
 	UInt16 type;
+	AsyncCodecID codec;
+	UInt8 flags;
 	AsyncCommand command;
 	UInt32 blockTag;
-	UInt32 bodyLength;
+	UInt64 bodyLength;
 } AsyncConnectionHeader;
 
 /// AsyncConnection delegate protocol
@@ -45,42 +87,178 @@ typedef struct {
 - (void)connectionDidDisconnect:(AsyncConnection *)theConnection;
 - (void)connection:(AsyncConnection *)theConnection didReceiveCommand:(AsyncCommand)command object:(id)object;
 - (void)connection:(AsyncConnection *)theConnection didReceiveCommand:(AsyncCommand)command object:(id)object responseBlock:(AsyncNetworkResponseBlock)block;
+- (void)connection:(AsyncConnection *)theConnection didReceiveChunk:(NSData *)chunk forCommand:(AsyncCommand)command stream:(UInt32)streamID finished:(BOOL)finished;
 - (void)connection:(AsyncConnection *)theConnection didFailWithError:(NSError *)error;
+- (void)connectionDidReachHighWatermark:(AsyncConnection *)theConnection;
+- (void)connectionDidDrainToLowWatermark:(AsyncConnection *)theConnection;
+- (void)connection:(AsyncConnection *)theConnection didUpdateRoundTripTime:(NSTimeInterval)roundTripTime;
+- (void)connection:(AsyncConnection *)theConnection didSubscribeToTopic:(NSString *)topic;
+- (void)connection:(AsyncConnection *)theConnection didUnsubscribeFromTopic:(NSString *)topic;
 
 @end
 
 /// The AsyncConnection handles a single socket connection to the target host or net service
 @interface AsyncConnection : NSObject <GCDAsyncSocketDelegate, NSNetServiceDelegate> {
 	@private
-	AsyncConnectionHeader _lastHeader;
-    UInt32 _currentBlockTag;
-    NSMutableDictionary *_responseBlocks;
+	NSMutableData *_readBuffer;
+    AsyncPendingRequests *_pendingRequests;
+    UInt32 _peerCapabilities;
+    NSMutableData *_writeBuffer;
+    BOOL _flushScheduled;
+    UInt64 _queuedWriteBytes;
+    NSUInteger _queuedWriteFrames;
+    NSUInteger _writeBufferFrames;
+    NSMutableArray *_queuedWriteFrameCounts;
+    NSMutableArray *_queuedWriteTimes;
+    BOOL _aboveHighWatermark;
+    NSArray *_lanes;
+    NSArray *_fragmentBuffers;
+    UInt64 _laneBytes;
+    NSUInteger _laneFrames;
+    NSUInteger _laneCredit;
+    NSMutableDictionary *_commandPriorities;
+    NSUInteger _heartbeatGeneration;
+    NSUInteger _missedHeartbeats;
+    UInt32 _pingSequence;
+    CFAbsoluteTime _pingTimes[16]; // send times of the outstanding pings (ring by sequence, 0: answered)
+    AsyncConnectionCounters _counters;
+    CFAbsoluteTime _startTime;
+    CFAbsoluteTime _connectedTime;
+    NSMutableDictionary *_sentFramesByCommand;
+    NSMutableDictionary *_receivedFramesByCommand;
+    NSMutableDictionary *_latencyHistograms;
+    NSMutableArray *_outgoingStreams;
+    UInt32 _currentStreamID;
+    BOOL _receiving;
+    NSMutableSet *_subscribedTopics;
+    NSMutableSet *_peerTopics;
+    NSMutableIndexSet *_incomingRequestTags;
+    NSMutableIndexSet *_cancelledRequestTags;
+    NSUInteger _connectGeneration;
+    GCDAsyncSocket *_alternateSocket; // socket racing the other address family
+    NSData *_alternateAddress;        // address of the other family until its race starts
 }
 
 @property (readonly) GCDAsyncSocket *socket;
 @property (readonly) BOOL connected;
 
 @property (unsafe_unretained) id<AsyncConnectionDelegate> delegate;
+@property (strong, nonatomic) dispatch_queue_t delegateQueue; // serial queue for socket and delegate callbacks (default: AsyncNetworkDispatchQueue())
 @property (readonly) NSNetService *netService; // the target net service (host & port are ignored if set)
 @property (readonly) NSString *host;           // the target host
 @property (readonly) NSUInteger port;          // the target port
 @property (assign) NSTimeInterval timeout;     // connection timeout
+@property (strong) AsyncAddressCache *addressCache; // resolved addresses of hosts and net services (default: shared cache, nil: resolve on every start)
+@property (assign) NSTimeInterval alternateAddressDelay; // with IPv4 and IPv6 addresses, the other family is also tried after this delay
+@property (strong) id<AsyncCodec> codec;       // codec for outgoing objects (default: AsyncKeyedArchiverCodec)
+@property (assign) NSTimeInterval requestTimeout;  // response timeout for requests (negative: no timeout)
+@property (readonly) NSUInteger pendingRequestCount; // number of requests waiting for a response
+@property (assign) NSUInteger maxBodySize;         // larger bodies from the peer are rejected (also after reassembly and decompression)
+
+// compression is only used if the peer announced that it can decompress
+@property (assign) BOOL compressionEnabled;          // compress large bodies (default: NO)
+@property (assign) NSUInteger compressionThreshold;  // bodies smaller than this are sent uncompressed
+@property (readonly) UInt64 uncompressedBytesSent;   // size of all compressed bodies before compression
+@property (readonly) UInt64 compressedBytesSent;     // size of all compressed bodies after compression
+@property (readonly) double compressionRatio;        // compressedBytesSent / uncompressedBytesSent
+@property (readonly) NSTimeInterval compressionTime;   // total time spent compressing
+@property (readonly) NSTimeInterval decompressionTime; // total time spent decompressing
+
+// batching collects outgoing frames and writes them at once (the wire format does not change)
+@property (assign) BOOL batchingEnabled;        // batch outgoing frames (default: NO)
+@property (assign) NSTimeInterval batchMaxDelay; // flush after this delay (0: at the end of the current queue turn)
+@property (assign) NSUInteger batchMaxBytes;     // flush as soon as the batch reaches this size
+
+// streams are sent in chunks, only streamWindowSize bytes are queued for writing at any time
+@property (assign) NSUInteger streamChunkSize;   // chunk size for input streams
+@property (assign) NSUInteger streamWindowSize;  // maximum number of queued bytes while streaming
+
+// the write queue holds frames that were sent but not yet written to the socket
+@property (readonly) NSUInteger queuedWriteBytes;  // bytes waiting to be written (including batched frames)
+@property (readonly) NSUInteger queuedWriteFrames; // frames waiting to be written (including batched frames)
+@property (assign) NSUInteger writeHighWatermark;  // the write policy applies at and above this size
+@property (assign) NSUInteger writeLowWatermark;   // the delegate is notified once the queue drained below this size
+@property (assign) AsyncConnectionWritePolicy writePolicy; // what happens to frames sent above the high watermark
+@property (readonly) UInt64 droppedFrameCount;     // number of frames dropped by the write policy
+
+// frames wait in priority lanes until the socket has room, large bodies are split into fragments
+@property (assign) NSUInteger fragmentSize;        // maximum body size of a fragment
+@property (assign) NSUInteger writeWindowSize;     // maximum number of bytes handed to the socket at once
+
+// heartbeats are sent once connected if the peer supports them (set these before connecting)
+@property (assign) NSTimeInterval heartbeatInterval;      // time between pings (0: no heartbeat, default)
+@property (assign) NSUInteger maxMissedHeartbeats;        // disconnect after this many unanswered pings
+@property (readonly) NSTimeInterval lastRoundTripTime;    // round trip time of the last pong
+@property (readonly) NSTimeInterval roundTripTime;        // smoothed round trip time (0: not measured yet)
+@property (readonly) NSTimeInterval roundTripTimeJitter;  // smoothed deviation of the round trip time
+
+// counters are cheap snapshots, the dictionaries map commands to the number of messages, requests and stream chunks
+@property (readonly) AsyncConnectionCounters counters;
+@property (readonly) NSDictionary *sentFramesByCommand;
+@property (readonly) NSDictionary *receivedFramesByCommand;
+
+// topics are subscribed at peers that support them and subscribed again after reconnecting
+// a topic ending in * matches all topics that start with the part before the *
+@property (readonly) NSSet *subscribedTopics;  // topics we subscribed to at the peer
+@property (readonly) NSSet *peerTopics;        // topics the peer subscribed to at us
+- (void)subscribeToTopic:(NSString *)topic;
+- (void)unsubscribeFromTopic:(NSString *)topic;
+
+// round trip times of answered requests from sending to the response by command (copies of AsyncLatencyHistogram)
+@property (readonly) NSDictionary *latencyHistograms;
+- (AsyncLatencyHistogram *)latencyHistogramForCommand:(AsyncCommand)command;
 
 + (NSRunLoop *)networkRunLoop;
 
 + (id)connectionWithSocket:(GCDAsyncSocket *)socket;
++ (id)connectionWithSocket:(GCDAsyncSocket *)socket delegateQueue:(dispatch_queue_t)queue;
 + (id)connectionWithNetService:(NSNetService *)netService;
 + (id)connectionWithHost:(NSString *)host port:(NSUInteger)port;
 
+// a connection initialized with a delegate queue only starts receiving with -start (configure it first)
 - (id)initWithSocket:(GCDAsyncSocket *)theSocket;
+- (id)initWithSocket:(GCDAsyncSocket *)theSocket delegateQueue:(dispatch_queue_t)queue;
 - (id)initWithNetService:(NSNetService *)theNetService;
 - (id)initWithHost:(NSString *)host port:(NSUInteger)port;
 
 - (void)start;
 - (void)cancel;
+- (void)flush;
 
+// the connection is not thread safe, use these to call it from other queues
+- (void)performBlock:(dispatch_block_t)block;
+- (void)performBlockAndWait:(dispatch_block_t)block;
+
+// priorities are announced in the frame header, peers that do not support them receive normal frames
+- (void)setPriority:(AsyncConnectionPriority)priority forCommand:(AsyncCommand)command;
+- (AsyncConnectionPriority)priorityForCommand:(AsyncCommand)command;
+
+// the response block receives an NSError (AsyncNetworkErrorDomain) if the request times out or the connection closes
+// returns the tag of the request (0 without a response block)
+- (UInt32)sendCommand:(AsyncCommand)command object:(id<NSCoding>)object timeout:(NSTimeInterval)timeout responseBlock:(AsyncNetworkResponseBlock)block;
 - (void)sendCommand:(AsyncCommand)command object:(id<NSCoding>)object responseBlock:(AsyncNetworkResponseBlock)block;
 - (void)sendCommand:(AsyncCommand)command object:(id<NSCoding>)object;
 - (void)sendObject:(id<NSCoding>)object;
 
+// a cancelled request never calls its response block, peers that support it do not send the response
+- (void)cancelRequestWithTag:(UInt32)tag;
+
+// raw data is sent as is and received as NSData without any encoding
+- (void)sendCommand:(AsyncCommand)command data:(NSData *)data responseBlock:(AsyncNetworkResponseBlock)block;
+- (void)sendCommand:(AsyncCommand)command data:(NSData *)data;
+
+// encoded bodies are sent as is and decoded by the peer with the codec of the given id (e.g. to encode a broadcast once)
+- (void)sendCommand:(AsyncCommand)command body:(NSData *)body codecID:(AsyncCodecID)codecID responseBlock:(AsyncNetworkResponseBlock)block;
+
+// streams are received chunk by chunk with connection:didReceiveChunk:forCommand:stream:finished:
+// they are started once the peer announced that it supports streams and return the stream id
+- (UInt32)sendCommand:(AsyncCommand)command stream:(NSInputStream *)inputStream;
+- (UInt32)sendCommand:(AsyncCommand)command chunkProducer:(AsyncConnectionChunkProducer)producer;
+
 @end
+
+/// Add counters to a total (gauges are added as well)
+void AsyncConnectionAddCounters(AsyncConnectionCounters *total, AsyncConnectionCounters counters);
+
+/// Add counts by command to a total
+void AsyncConnectionAddCommandCounts(NSMutableDictionary *total, NSDictionary *counts);
@@ -24,32 +24,165 @@
 
 #import "AsyncConnection.h"
 #import "AsyncRequest.h"
+#import <zlib.h>
+#import "AsyncTrace.h"
 
-#define AsyncConnectionHeaderSize sizeof(AsyncConnectionHeader)
-const NSUInteger AsyncConnectionHeaderTag = 1;
-const NSUInteger AsyncConnectionBodyTag = 2;
+#define AsyncConnectionHeaderSize 16             // size of a fixed header
+#define AsyncConnectionCompactHeaderMaxSize 23   // marker, flags, codec and varints (command 5, tag 5, body length 10)
+#define AsyncConnectionCompactHeaderMarker 0x80  // fixed headers start with the low byte of a small type
+#define AsyncConnectionCompactHeaderVersion 0
+#define AsyncConnectionPingRingSize (sizeof(_pingTimes) / sizeof(_pingTimes[0])) // pings whose pong is still accepted
+const NSUInteger AsyncConnectionFrameTag = 1;
 const NSUInteger AsyncConnectionTypeMessage = 1;
 const NSUInteger AsyncConnectionTypeRequest = 2;
 const NSUInteger AsyncConnectionTypeResponse = 3;
+const NSUInteger AsyncConnectionTypeHello = 4;      // command carries the capabilities of the sender
+const NSUInteger AsyncConnectionTypeStream = 5;     // a chunk of a stream (blockTag is the stream id)
+const NSUInteger AsyncConnectionTypePing = 6;       // heartbeat (blockTag is the sequence number)
+const NSUInteger AsyncConnectionTypePong = 7;       // heartbeat answer (echoes the blockTag of the ping)
+const NSUInteger AsyncConnectionTypeSubscribe = 8;  // subscribe to the topic in the body (UTF-8)
+const NSUInteger AsyncConnectionTypeUnsubscribe = 9; // unsubscribe from the topic in the body (UTF-8)
+const NSUInteger AsyncConnectionTypeCancel = 10;    // the request with the blockTag was cancelled
+
+// header flags
+enum {
+	AsyncConnectionFlagCompressed = 1 << 0,   // body is zlib compressed
+	AsyncConnectionFlagFinal = 1 << 1,        // last chunk of a stream
+	AsyncConnectionFlagPriorityMask = 3 << 2, // AsyncConnectionPriority of the frame
+	AsyncConnectionFlagMore = 1 << 4          // the body continues in the next frame of the same priority
+};
+#define AsyncConnectionFlagPriorityShift 2
+
+// normal priority frames written for each low priority frame while both lanes are busy
+const NSUInteger AsyncConnectionNormalLaneWeight = 4;
+
+// capabilities announced in the hello frame (older peers never send one)
+enum {
+	AsyncConnectionCapabilityCompression = 1 << 0,
+	AsyncConnectionCapabilityStreaming = 1 << 1,
+	AsyncConnectionCapabilityPriorities = 1 << 2,
+	AsyncConnectionCapabilityCompactHeader = 1 << 3,
+	AsyncConnectionCapabilityHeartbeat = 1 << 4,
+	AsyncConnectionCapabilityTopics = 1 << 5,
+	AsyncConnectionCapabilityCancel = 1 << 6,
+	AsyncConnectionCapabilityCodecs = 1 << 7, // codec and flags of the fixed header are set (older peers send struct padding)
+	AsyncConnectionCapabilities = AsyncConnectionCapabilityCompression | AsyncConnectionCapabilityStreaming | AsyncConnectionCapabilityPriorities | AsyncConnectionCapabilityCompactHeader | AsyncConnectionCapabilityHeartbeat | AsyncConnectionCapabilityTopics | AsyncConnectionCapabilityCancel | AsyncConnectionCapabilityCodecs
+};
+
+// an outgoing stream that is sent chunk by chunk
+@interface AsyncConnectionStream : NSObject
+@property (assign) UInt32 streamID;
+@property (assign) AsyncCommand command;
+@property (copy) AsyncConnectionChunkProducer producer;
+@end
+
+@implementation AsyncConnectionStream
+@synthesize streamID = _streamID;
+@synthesize command = _command;
+@synthesize producer = _producer;
+@end
+
+// an outgoing frame waiting in a priority lane
+@interface AsyncConnectionFrame : NSObject
+@property (assign) AsyncConnectionHeader header;
+@property (strong) NSData *body;
+@property (assign) NSUInteger offset; // number of body bytes that were written
+@property (assign) CFAbsoluteTime queuedTime; // when the frame entered the lane (only while tracing)
+@end
+
+@implementation AsyncConnectionFrame
+@synthesize header = _header;
+@synthesize body = _body;
+@synthesize offset = _offset;
+@synthesize queuedTime = _queuedTime;
+@end
 
 // private types and functions
 NSData *HeaderToData(AsyncConnectionHeader header);
-AsyncConnectionHeader DataToHeader(NSData *data);
+NSData *CompactHeaderToData(AsyncConnectionHeader header);
+AsyncConnectionHeader BytesToHeader(const void *bytes);
+NSInteger ParseHeader(const UInt8 *bytes, NSUInteger length, AsyncConnectionHeader *header);
+NSData *FrameData(NSData *headerData, NSData *body);
+AsyncConnectionPriority PriorityOfHeader(AsyncConnectionHeader header);
+BOOL IsControlType(NSUInteger type);
+void CountCommand(NSMutableDictionary *counts, AsyncCommand command);
 
 @interface AsyncConnection ()
+- (AsyncConnectionHeader)headerWithCommand:(AsyncCommand)command timeout:(NSTimeInterval)timeout responseBlock:(AsyncNetworkResponseBlock)block;
+- (void)failRequestWithTag:(UInt32)tag code:(NSInteger)code;
+- (void)failAllRequestsWithCode:(NSInteger)code;
 - (void)sendHeader:(AsyncConnectionHeader)header object:(id<NSCoding>)object;
-- (void)sendResponse:(id<NSCoding>)object tag:(UInt32)tag;
+- (void)sendHeader:(AsyncConnectionHeader)header body:(NSData *)bodyData;
+- (void)sendResponse:(id<NSCoding>)object tag:(UInt32)tag priority:(AsyncConnectionPriority)priority;
+- (void)sendHello;
+- (NSMutableArray *)nextLane;
+- (void)pumpLanes;
+- (void)writeFragmentFromLane:(NSMutableArray *)lane;
+- (void)resetLanes;
+- (void)connectToAddresses:(NSArray *)addresses;
+- (void)connectToAlternateAddress;
+- (BOOL)failOverToAlternateAddress;
+- (void)invalidateCachedAddresses;
+- (BOOL)removeQueuedFrameWithType:(NSUInteger)type tag:(UInt32)tag;
+- (void)sendPing;
+- (void)sendPongWithTag:(UInt32)tag;
+- (void)sendTopic:(NSString *)topic type:(NSUInteger)type;
+- (void)scheduleHeartbeat;
+- (void)heartbeat;
+- (void)updateRoundTripTime:(NSTimeInterval)sample;
+- (void)recordLatency:(NSTimeInterval)latency forCommand:(AsyncCommand)command;
+- (void)writeHeader:(AsyncConnectionHeader)header body:(NSData *)bodyData;
+- (void)writeFrameData:(NSData *)data frameCount:(NSUInteger)frameCount;
+- (BOOL)admitFrameWithHeader:(AsyncConnectionHeader)header;
+- (void)updateWriteWatermarks;
+- (void)scheduleFlush;
+- (void)pumpStreams;
+- (void)cancelStreamsWithCode:(NSInteger)code;
+- (NSData *)compressData:(NSData *)data;
+- (NSData *)decompressBytes:(const UInt8 *)bytes length:(NSUInteger)length;
+- (id)objectWithHeader:(AsyncConnectionHeader)header bytes:(const UInt8 *)bytes;
 - (void)respondToMessageWithHeader:(AsyncConnectionHeader)header object:(id<NSCoding>)object;
+- (void)startReceiving;
+- (void)readFrames;
+- (void)processReadBuffer;
 @end
 
 @implementation AsyncConnection
 
 @synthesize socket = _socket;
 @synthesize delegate = _delegate;
+@synthesize delegateQueue = _delegateQueue;
 @synthesize timeout = _timeout;
+@synthesize addressCache = _addressCache;
+@synthesize alternateAddressDelay = _alternateAddressDelay;
 @synthesize netService = _netService;
 @synthesize host = _host;
 @synthesize port = _port;
+@synthesize codec = _codec;
+@synthesize requestTimeout = _requestTimeout;
+@synthesize maxBodySize = _maxBodySize;
+@synthesize compressionEnabled = _compressionEnabled;
+@synthesize compressionThreshold = _compressionThreshold;
+@synthesize uncompressedBytesSent = _uncompressedBytesSent;
+@synthesize compressedBytesSent = _compressedBytesSent;
+@synthesize compressionTime = _compressionTime;
+@synthesize decompressionTime = _decompressionTime;
+@synthesize batchingEnabled = _batchingEnabled;
+@synthesize batchMaxDelay = _batchMaxDelay;
+@synthesize batchMaxBytes = _batchMaxBytes;
+@synthesize streamChunkSize = _streamChunkSize;
+@synthesize streamWindowSize = _streamWindowSize;
+@synthesize writeHighWatermark = _writeHighWatermark;
+@synthesize writeLowWatermark = _writeLowWatermark;
+@synthesize writePolicy = _writePolicy;
+@synthesize droppedFrameCount = _droppedFrameCount;
+@synthesize fragmentSize = _fragmentSize;
+@synthesize writeWindowSize = _writeWindowSize;
+@synthesize heartbeatInterval = _heartbeatInterval;
+@synthesize maxMissedHeartbeats = _maxMissedHeartbeats;
+@synthesize lastRoundTripTime = _lastRoundTripTime;
+@synthesize roundTripTime = _roundTripTime;
+@synthesize roundTripTimeJitter = _roundTripTimeJitter;
 
 
 // Create and return the run loop used for all network operations
@@ -70,6 +203,12 @@ AsyncConnectionHeader DataToHeader(NSData *data);
 	return [[self alloc] initWithSocket:socket];
 }
 
+// create a new connection with a socket that calls back on the given queue
++ (id)connectionWithSocket:(GCDAsyncSocket *)socket delegateQueue:(dispatch_queue_t)queue;
+{
+	return [[self alloc] initWithSocket:socket delegateQueue:queue];
+}
+
 // create a new connection with host and port
 + (id)connectionWithHost:(NSString *)theHost port:(NSUInteger)thePort;
 {
@@ -85,8 +224,41 @@ AsyncConnectionHeader DataToHeader(NSData *data);
     self = [super init];
     if (self) {
 		self.timeout = AsyncNetworkDefaultConnectionTimeout;
-        _responseBlocks = [NSMutableDictionary new];
-        _currentBlockTag = 0;
+		self.addressCache = [AsyncAddressCache sharedCache];
+		self.alternateAddressDelay = AsyncNetworkDefaultAlternateAddressDelay;
+		self.codec = [AsyncKeyedArchiverCodec codec];
+		self.requestTimeout = AsyncNetworkDefaultRequestTimeout;
+		self.maxBodySize = AsyncNetworkDefaultMaxBodySize;
+		self.compressionEnabled = NO;
+		self.compressionThreshold = AsyncNetworkDefaultCompressionThreshold;
+		self.batchingEnabled = NO;
+		self.batchMaxDelay = 0.0;
+		self.batchMaxBytes = AsyncNetworkDefaultBatchMaxBytes;
+		self.streamChunkSize = AsyncNetworkDefaultStreamChunkSize;
+		self.streamWindowSize = AsyncNetworkDefaultStreamWindowSize;
+		self.writeHighWatermark = AsyncNetworkDefaultWriteHighWatermark;
+		self.writeLowWatermark = AsyncNetworkDefaultWriteLowWatermark;
+		self.writePolicy = AsyncConnectionWritePolicyQueue;
+		self.fragmentSize = AsyncNetworkDefaultFragmentSize;
+		self.writeWindowSize = AsyncNetworkDefaultWriteWindowSize;
+		self.heartbeatInterval = 0.0;
+		self.maxMissedHeartbeats = AsyncNetworkDefaultMaxMissedHeartbeats;
+        _pendingRequests = [AsyncPendingRequests new];
+        _readBuffer = [NSMutableData new];
+        _writeBuffer = [NSMutableData new];
+        _outgoingStreams = [NSMutableArray new];
+        _queuedWriteFrameCounts = [NSMutableArray new];
+        _queuedWriteTimes = [NSMutableArray new];
+        _lanes = [NSArray arrayWithObjects:[NSMutableArray new], [NSMutableArray new], [NSMutableArray new], nil];
+        _fragmentBuffers = [NSArray arrayWithObjects:[NSMutableData new], [NSMutableData new], [NSMutableData new], nil];
+        _commandPriorities = [NSMutableDictionary new];
+        _sentFramesByCommand = [NSMutableDictionary new];
+        _receivedFramesByCommand = [NSMutableDictionary new];
+        _latencyHistograms = [NSMutableDictionary new];
+        _subscribedTopics = [NSMutableSet new];
+        _peerTopics = [NSMutableSet new];
+        _incomingRequestTags = [NSMutableIndexSet new];
+        _cancelledRequestTags = [NSMutableIndexSet new];
     }
     return self;
 }
@@ -105,16 +277,26 @@ AsyncConnectionHeader DataToHeader(NSData *data);
 
 // Init a connection with a socket
 - (id)initWithSocket:(GCDAsyncSocket *)socket;
+{
+	self = [self initWithSocket:socket delegateQueue:socket.delegateQueue];
+	if (self) {
+		// we are already connected -> start receiving and announce our capabilities
+		[self startReceiving];
+	}
+	return self;
+}
+
+// Init a connection with a socket that calls back on the given queue (receiving starts with -start)
+- (id)initWithSocket:(GCDAsyncSocket *)socket delegateQueue:(dispatch_queue_t)queue;
 {
 	self = [self init];
 	if (self) {
+		self.delegateQueue = queue;
 		_socket = socket;
-		self.socket.delegate = self;
+		[self.socket setDelegate:self delegateQueue:self.delegateQueue];
 		_port = self.socket.connectedPort;
 		_host = self.socket.connectedHost;
-		
-		// we are already connected -> start receiving
-		[self.socket readDataToLength:AsyncConnectionHeaderSize withTimeout:self.timeout tag:AsyncConnectionHeaderTag];
+		_connectedTime = CFAbsoluteTimeGetCurrent();
 	}
 	return self;
 }
@@ -145,9 +327,9 @@ AsyncConnectionHeader DataToHeader(NSData *data);
 - (NSString *)description;
 {
 #ifdef __LP64__
-	return [NSString stringWithFormat:@"<%s host=%@ port=%ld requests=%ld>", object_getClassName(self), self.host, self.port, _responseBlocks.count];
+	return [NSString stringWithFormat:@"<%s host=%@ port=%ld requests=%ld>", object_getClassName(self), self.host, self.port, _pendingRequests.count];
 #else
-	return [NSString stringWithFormat:@"<%s host=%@ port=%d requests=%d>", object_getClassName(self), self.host, self.port, _responseBlocks.count];
+	return [NSString stringWithFormat:@"<%s host=%@ port=%d requests=%d>", object_getClassName(self), self.host, self.port, _pendingRequests.count];
 #endif
 
 }
@@ -158,7 +340,20 @@ AsyncConnectionHeader DataToHeader(NSData *data);
 // Start the connection by creating a socket to connect to the host and port indicated in the request
 - (void)start;
 {
-	if (self.socket) return;
+	// an accepted socket is already connected -> start receiving on the delegate queue
+	if (self.socket) {
+		if (!_receiving) [self performBlock:^{
+			if (!_receiving && self.socket) [self startReceiving];
+		}];
+		return;
+	}
+	
+	// connect right away to cached addresses
+	NSArray *addresses = self.netService ? [self.addressCache addressesForNetService:self.netService] : [self.addressCache addressesForHost:self.host port:self.port];
+	if (addresses) {
+		[self connectToAddresses:addresses];
+		return;
+	}
 	
 	// resolve the net service if necessary
 	// this will trigger start again once the net service was resolved
@@ -168,26 +363,180 @@ AsyncConnectionHeader DataToHeader(NSData *data);
 		return;
 	}
 	
-	// create the socket
-	_socket = [[GCDAsyncSocket alloc] initWithDelegate:self delegateQueue:AsyncNetworkDispatchQueue()];
+	// look up the host in the background and remember its addresses
+	if (self.addressCache && !self.netService) {
+		NSUInteger generation = ++_connectGeneration;
+		[self.addressCache resolveHost:self.host port:self.port completionBlock:^(NSArray *resolved, NSError *error) {
+			[self performBlock:^{
+				if (generation != _connectGeneration || self.socket) return;
+				if (resolved) {
+					[self connectToAddresses:resolved];
+				} else if ([self.delegate respondsToSelector:@selector(connection:didFailWithError:)]) {
+					[self.delegate connection:self didFailWithError:error];
+				}
+			}];
+		}];
+		return;
+	}
+	
+	[self connectToAddresses:nil];
+}
+
+// create the socket and connect to the preferred address (or let the socket look up the host)
+// with addresses of both families the other family is raced after the alternate address delay
+- (void)connectToAddresses:(NSArray *)addresses;
+{
+	_connectGeneration++;
+	[_readBuffer setLength:0];
+	_peerCapabilities = 0;
+	_queuedWriteBytes = 0;
+	_queuedWriteFrames = 0;
+	[_queuedWriteFrameCounts removeAllObjects];
+	[_queuedWriteTimes removeAllObjects];
+	_aboveHighWatermark = NO;
+	[self resetLanes];
+	_heartbeatGeneration++;
+	_lastRoundTripTime = 0;
+	_roundTripTime = 0;
+	_roundTripTimeJitter = 0;
+	[_peerTopics removeAllObjects];
+	[_incomingRequestTags removeAllIndexes];
+	[_cancelledRequestTags removeAllIndexes];
+	_startTime = CFAbsoluteTimeGetCurrent();
+	_connectedTime = 0;
+	_counters.connectTime = 0;
+	_counters.handshakeTime = 0;
+	_receiving = NO;
+	_socket = [[GCDAsyncSocket alloc] initWithDelegate:self delegateQueue:self.delegateQueue];
 	[self.socket setIPv6Enabled:YES];
 	
-	// connect to host and port
+	// the first address of the preferred family and the first one of the other family
+	NSData *address = nil;
+	_alternateAddress = nil;
+	for (NSData *candidate in addresses) {
+		BOOL preferred = self.socket.isIPv4PreferredOverIPv6 ? [GCDAsyncSocket isIPv4Address:candidate] : [GCDAsyncSocket isIPv6Address:candidate];
+		if (preferred && !address) address = candidate;
+		if (!preferred && !_alternateAddress) _alternateAddress = candidate;
+	}
+	if (!address) {
+		address = _alternateAddress;
+		_alternateAddress = nil;
+	}
+	
+	// connect to the address or host and port (the other family is tried if the connect fails right away)
 	NSError *error;
-	if (![self.socket connectToHost:self.host onPort:self.port withTimeout:self.timeout error:&error]) {
+	BOOL connecting = address ? [self.socket connectToAddress:address withTimeout:self.timeout error:&error] : [self.socket connectToHost:self.host onPort:self.port withTimeout:self.timeout error:&error];
+	if (!connecting && ![self failOverToAlternateAddress]) {
 		if ([self.delegate respondsToSelector:@selector(connection:didFailWithError:)]) {
 			[self.delegate connection:self didFailWithError:error];
 		}
 		_socket = nil;
 		return;
 	}
+	
+	// race the other family if the preferred one does not connect in time
+	if (_alternateAddress) {
+		NSUInteger generation = _connectGeneration;
+		__weak AsyncConnection *weakSelf = self;
+		dispatch_after(dispatch_time(DISPATCH_TIME_NOW, (int64_t)(self.alternateAddressDelay * NSEC_PER_SEC)), self.delegateQueue, ^{
+			AsyncConnection *strongSelf = weakSelf;
+			if (strongSelf && strongSelf->_connectGeneration == generation) [strongSelf connectToAlternateAddress];
+		});
+	}
+}
+
+// start connecting to the address of the other family next to the socket
+- (void)connectToAlternateAddress;
+{
+	NSData *address = _alternateAddress;
+	_alternateAddress = nil;
+	if (!address || _alternateSocket) return;
+	GCDAsyncSocket *socket = [[GCDAsyncSocket alloc] initWithDelegate:self delegateQueue:self.delegateQueue];
+	[socket setIPv6Enabled:YES];
+	if ([socket connectToAddress:address withTimeout:self.timeout error:NULL]) _alternateSocket = socket;
+}
+
+// the socket could not connect: continue with the other family if it is still in the race
+// returns NO if there is nothing left to try
+- (BOOL)failOverToAlternateAddress;
+{
+	[self connectToAlternateAddress];
+	if (!_alternateSocket) return NO;
+	_socket = _alternateSocket;
+	_alternateSocket = nil;
+	return YES;
 }
 
 // Cancel an active connection
+// the socket reports its disconnect later (when the connection may already be started again), so clean up now
 - (void)cancel;
 {
-	[self.socket disconnect];
+	NSUInteger generation = ++_connectGeneration;
+	[_writeBuffer setLength:0];
+	_writeBufferFrames = 0;
+	[self resetLanes];
+	_heartbeatGeneration++;
+	[_alternateSocket disconnect];
+	_alternateSocket = nil;
+	_alternateAddress = nil;
+	GCDAsyncSocket *socket = self.socket;
 	_socket = nil;
+	if (!socket) return;
+	[socket disconnect];
+	[self cancelStreamsWithCode:0];
+	
+	// fail the pending requests and report the disconnect unless the connection was started again
+	NSArray *responseBlocks = [_pendingRequests removeAllResponseBlocks];
+	__weak AsyncConnection *weakSelf = self;
+	dispatch_async(self.delegateQueue, ^{
+		NSError *error = [NSError errorWithDomain:AsyncNetworkErrorDomain code:AsyncNetworkErrorDisconnected userInfo:nil];
+		for (AsyncNetworkResponseBlock block in responseBlocks) {
+			block(error);
+		}
+		AsyncConnection *strongSelf = weakSelf;
+		if (!strongSelf || strongSelf->_connectGeneration != generation) return;
+		if ([strongSelf.delegate respondsToSelector:@selector(connectionDidDisconnect:)]) {
+			[strongSelf.delegate connectionDidDisconnect:strongSelf];
+		}
+	});
+}
+
+// write all batched frames
+- (void)flush;
+{
+	_flushScheduled = NO;
+	if (_writeBuffer.length == 0 || !self.socket) return;
+	
+	// hand the batch to the socket and start a new one
+	NSData *batch = _writeBuffer;
+	_writeBuffer = [NSMutableData dataWithCapacity:batch.length];
+	[self writeFrameData:batch frameCount:_writeBufferFrames];
+	_writeBufferFrames = 0;
+}
+
+// run a block on the delegate queue (directly if we are on it)
+- (void)performBlock:(dispatch_block_t)block;
+{
+	AsyncNetworkPerformBlock(self.delegateQueue, NO, block);
+}
+
+// run a block on the delegate queue and wait for it
+- (void)performBlockAndWait:(dispatch_block_t)block;
+{
+	AsyncNetworkPerformBlock(self.delegateQueue, YES, block);
+}
+
+// the delegate queue defaults to the global AsyncNetwork queue
+- (dispatch_queue_t)delegateQueue;
+{
+	return _delegateQueue ? _delegateQueue : AsyncNetworkDispatchQueue();
+}
+
+// set the delegate queue (before starting the connection)
+- (void)setDelegateQueue:(dispatch_queue_t)delegateQueue;
+{
+	if (delegateQueue) AsyncNetworkRegisterQueue(delegateQueue);
+	_delegateQueue = delegateQueue;
 }
 
 // are we connected?
@@ -196,24 +545,130 @@ AsyncConnectionHeader DataToHeader(NSData *data);
 	return (self.socket.connectedHost != nil);
 }
 
-// send command and object with response block
-- (void)sendCommand:(AsyncCommand)command object:(id<NSCoding>)object responseBlock:(AsyncNetworkResponseBlock)block;
+// number of requests waiting for a response
+- (NSUInteger)pendingRequestCount;
 {
-	// prepare the header
-	AsyncConnectionHeader header;
-	header.type = block ? AsyncConnectionTypeRequest : AsyncConnectionTypeMessage;
-	header.command = command;
-	header.bodyLength = 0;
-	
-	// store response block
-	if (block) {
-		header.blockTag = ++_currentBlockTag;
-		[_responseBlocks setObject:block forKey:[NSNumber numberWithInteger:header.blockTag]];
+	return _pendingRequests.count;
+}
+
+// bytes waiting to be written
+- (NSUInteger)queuedWriteBytes;
+{
+	return (NSUInteger)(_queuedWriteBytes + _laneBytes) + _writeBuffer.length;
+}
+
+// frames waiting to be written
+- (NSUInteger)queuedWriteFrames;
+{
+	return _queuedWriteFrames + _writeBufferFrames + _laneFrames;
+}
+
+// snapshot of the counters
+- (AsyncConnectionCounters)counters;
+{
+	AsyncConnectionCounters counters = _counters;
+	counters.queuedWriteBytes = self.queuedWriteBytes;
+	counters.queuedWriteFrames = self.queuedWriteFrames;
+	counters.pendingRequests = _pendingRequests.count;
+	counters.connections = self.connected ? 1 : 0;
+	return counters;
+}
+
+// messages, requests and stream chunks sent by command
+- (NSDictionary *)sentFramesByCommand;
+{
+	return [_sentFramesByCommand copy];
+}
+
+// messages, requests and stream chunks received by command
+- (NSDictionary *)receivedFramesByCommand;
+{
+	return [_receivedFramesByCommand copy];
+}
+
+// topics we subscribed to
+- (NSSet *)subscribedTopics;
+{
+	return [_subscribedTopics copy];
+}
+
+// topics the peer subscribed to
+- (NSSet *)peerTopics;
+{
+	return [_peerTopics copy];
+}
+
+// subscribe to a topic (now if the peer supports topics, otherwise once it announced them)
+- (void)subscribeToTopic:(NSString *)topic;
+{
+	if ([_subscribedTopics containsObject:topic]) return;
+	[_subscribedTopics addObject:topic];
+	if (self.socket && (_peerCapabilities & AsyncConnectionCapabilityTopics)) {
+		[self sendTopic:topic type:AsyncConnectionTypeSubscribe];
+	}
+}
+
+// unsubscribe from a topic
+- (void)unsubscribeFromTopic:(NSString *)topic;
+{
+	if (![_subscribedTopics containsObject:topic]) return;
+	[_subscribedTopics removeObject:topic];
+	if (self.socket && (_peerCapabilities & AsyncConnectionCapabilityTopics)) {
+		[self sendTopic:topic type:AsyncConnectionTypeUnsubscribe];
+	}
+}
+
+// round trip times by command
+- (NSDictionary *)latencyHistograms;
+{
+	NSMutableDictionary *histograms = [NSMutableDictionary dictionaryWithCapacity:_latencyHistograms.count];
+	[AsyncLatencyHistogram addHistograms:_latencyHistograms toHistograms:histograms];
+	return histograms;
+}
+
+// round trip times of a command
+- (AsyncLatencyHistogram *)latencyHistogramForCommand:(AsyncCommand)command;
+{
+	return [[_latencyHistograms objectForKey:[NSNumber numberWithUnsignedInt:command]] copy];
+}
+
+// set the priority lane of a command
+- (void)setPriority:(AsyncConnectionPriority)priority forCommand:(AsyncCommand)command;
+{
+	NSNumber *key = [NSNumber numberWithUnsignedInt:command];
+	if (priority == AsyncConnectionPriorityNormal) {
+		[_commandPriorities removeObjectForKey:key];
 	} else {
-		header.blockTag = 0;
+		[_commandPriorities setObject:[NSNumber numberWithInt:priority] forKey:key];
 	}
-	
+}
+
+// the priority lane of a command
+- (AsyncConnectionPriority)priorityForCommand:(AsyncCommand)command;
+{
+	NSNumber *priority = [_commandPriorities objectForKey:[NSNumber numberWithUnsignedInt:command]];
+	return priority ? (AsyncConnectionPriority)priority.intValue : AsyncConnectionPriorityNormal;
+}
+
+// compressed size relative to the uncompressed size of all compressed bodies
+- (double)compressionRatio;
+{
+	if (_uncompressedBytesSent == 0) return 1.0;
+	return (double)_compressedBytesSent / (double)_uncompressedBytesSent;
+}
+
+// send command and object with response block and response timeout
+- (UInt32)sendCommand:(AsyncCommand)command object:(id<NSCoding>)object timeout:(NSTimeInterval)timeout responseBlock:(AsyncNetworkResponseBlock)block;
+{
+	AsyncConnectionHeader header = [self headerWithCommand:command timeout:timeout responseBlock:block];
 	[self sendHeader:header object:object];
+	return header.blockTag;
+}
+
+// send command and object with response block
+- (void)sendCommand:(AsyncCommand)command object:(id<NSCoding>)object responseBlock:(AsyncNetworkResponseBlock)block;
+{
+	[self sendCommand:command object:object timeout:self.requestTimeout responseBlock:block];
 }
 
 // send command and object without response block
@@ -228,35 +683,343 @@ AsyncConnectionHeader DataToHeader(NSData *data);
 	[self sendCommand:0 object:object responseBlock:nil];
 }
 
+// send command and raw data with response block
+- (void)sendCommand:(AsyncCommand)command data:(NSData *)data responseBlock:(AsyncNetworkResponseBlock)block;
+{
+	AsyncConnectionHeader header = [self headerWithCommand:command timeout:self.requestTimeout responseBlock:block];
+	header.codec = AsyncCodecIDRaw;
+	[self sendHeader:header body:data];
+}
+
+// send command and raw data without response block
+- (void)sendCommand:(AsyncCommand)command data:(NSData *)data;
+{
+	[self sendCommand:command data:data responseBlock:nil];
+}
+
+// send command and an encoded body with response block
+- (void)sendCommand:(AsyncCommand)command body:(NSData *)body codecID:(AsyncCodecID)codecID responseBlock:(AsyncNetworkResponseBlock)block;
+{
+	AsyncConnectionHeader header = [self headerWithCommand:command timeout:self.requestTimeout responseBlock:block];
+	header.codec = codecID;
+	[self sendHeader:header body:body];
+}
+
+// cancel a pending request
+- (void)cancelRequestWithTag:(UInt32)tag;
+{
+	if (![_pendingRequests removeResponseBlockForTag:tag]) return;
+	
+	// a request that is still waiting in its lane is simply not sent
+	if ([self removeQueuedFrameWithType:AsyncConnectionTypeRequest tag:tag]) return;
+	if (self.socket && (_peerCapabilities & AsyncConnectionCapabilityCancel)) {
+		AsyncConnectionHeader header = {0};
+		header.type = AsyncConnectionTypeCancel;
+		header.blockTag = tag;
+		[self sendHeader:header body:nil];
+	}
+}
+
+// send a stream produced chunk by chunk
+- (UInt32)sendCommand:(AsyncCommand)command chunkProducer:(AsyncConnectionChunkProducer)producer;
+{
+	// stream id 0 is never used
+	if (++_currentStreamID == 0) _currentStreamID = 1;
+	
+	AsyncConnectionStream *stream = [AsyncConnectionStream new];
+	stream.streamID = _currentStreamID;
+	stream.command = command;
+	stream.producer = producer;
+	[_outgoingStreams addObject:stream];
+	[self pumpStreams];
+	return stream.streamID;
+}
+
+// send the contents of an input stream chunk by chunk
+- (UInt32)sendCommand:(AsyncCommand)command stream:(NSInputStream *)inputStream;
+{
+	NSUInteger chunkSize = self.streamChunkSize;
+	[inputStream open];
+	return [self sendCommand:command chunkProducer:^NSData *{
+		NSMutableData *chunk = [NSMutableData dataWithLength:chunkSize];
+		NSInteger length = [inputStream read:chunk.mutableBytes maxLength:chunkSize];
+		if (length <= 0) {
+			if (length < 0) NSLog(@"AsyncConnection: could not read stream: %@", inputStream.streamError);
+			[inputStream close];
+			return nil;
+		}
+		[chunk setLength:length];
+		return chunk;
+	}];
+}
+
 
 #pragma mark - Private Methods
 
+// prepare the header for a message or request
+- (AsyncConnectionHeader)headerWithCommand:(AsyncCommand)command timeout:(NSTimeInterval)timeout responseBlock:(AsyncNetworkResponseBlock)block;
+{
+	AsyncConnectionHeader header = {0};
+	header.type = block ? AsyncConnectionTypeRequest : AsyncConnectionTypeMessage;
+	header.command = command;
+	header.bodyLength = 0;
+	
+	// store response block
+	if (block) {
+		header.blockTag = [_pendingRequests addResponseBlock:block command:command];
+	} else {
+		header.blockTag = 0;
+	}
+	
+	// fail the request if no response arrives in time
+	if (block && timeout > 0) {
+		__weak AsyncConnection *weakSelf = self;
+		UInt32 tag = header.blockTag;
+		dispatch_after(dispatch_time(DISPATCH_TIME_NOW, (int64_t)(timeout * NSEC_PER_SEC)), self.delegateQueue, ^{
+			[weakSelf failRequestWithTag:tag code:AsyncNetworkErrorRequestTimeout];
+		});
+	}
+	
+	return header;
+}
+
+// call the response block of a pending request with an error
+- (void)failRequestWithTag:(UInt32)tag code:(NSInteger)code;
+{
+	AsyncNetworkResponseBlock block = [_pendingRequests removeResponseBlockForTag:tag];
+	if (block) block([NSError errorWithDomain:AsyncNetworkErrorDomain code:code userInfo:nil]);
+}
+
+// call the response blocks of all pending requests with an error
+- (void)failAllRequestsWithCode:(NSInteger)code;
+{
+	NSError *error = [NSError errorWithDomain:AsyncNetworkErrorDomain code:code userInfo:nil];
+	for (AsyncNetworkResponseBlock block in [_pendingRequests removeAllResponseBlocks]) {
+		block(error);
+	}
+}
+
 // generic send
 - (void)sendHeader:(AsyncConnectionHeader)header object:(id<NSCoding>)object;
 {
-	NSAssert(self.socket, @"AsyncConnection: attempted to send an object without being connected");
-	
 	// encode data
 	NSData *bodyData = nil;
 	if (object) {
-		bodyData = [NSKeyedArchiver archivedDataWithRootObject:object];
-		header.bodyLength = (UInt32)bodyData.length;
+		// peers without codec support decode every body with NSKeyedUnarchiver
+		id<AsyncCodec> codec = (_peerCapabilities & AsyncConnectionCapabilityCodecs) ? self.codec : AsyncCodecForID(AsyncCodecIDKeyedArchiver);
+		CFAbsoluteTime start = CFAbsoluteTimeGetCurrent();
+		@try {
+			bodyData = [codec encodeObject:object];
+		}
+		@catch (NSException *exception) {
+			// the request was never sent, so it must not stay pending
+			[_pendingRequests removeResponseBlockForTag:header.blockTag];
+			@throw;
+		}
+		CFAbsoluteTime end = CFAbsoluteTimeGetCurrent();
+		_counters.encodeTime += end - start;
+		header.codec = codec.codecID;
+		AsyncTraceRecord("encode", (__bridge void *)self, header.command, header.blockTag, start, end);
 	}
 	
-	// send the header
-	NSData *headerData = [NSData dataWithBytes:&header length:AsyncConnectionHeaderSize];
-	[self.socket writeData:headerData withTimeout:self.timeout tag:AsyncConnectionHeaderTag];
+	[self sendHeader:header body:bodyData];
+}
+
+// send an encoded body
+- (void)sendHeader:(AsyncConnectionHeader)header body:(NSData *)bodyData;
+{
+	NSAssert(self.socket, @"AsyncConnection: attempted to send an object without being connected");
+	
+	// raw data goes to a peer without codec support as an archived NSData object
+	if (bodyData && header.codec == AsyncCodecIDRaw && !(_peerCapabilities & AsyncConnectionCapabilityCodecs)) {
+		bodyData = [NSKeyedArchiver archivedDataWithRootObject:bodyData];
+		header.codec = AsyncCodecIDKeyedArchiver;
+	}
 	
-	// send the body
-	if (header.bodyLength > 0) [self.socket writeData:bodyData withTimeout:self.timeout tag:AsyncConnectionBodyTag];
+	// a body encoded with another codec can not be re-encoded for a peer without codec support
+	if (bodyData && header.codec != AsyncCodecIDKeyedArchiver && !(_peerCapabilities & AsyncConnectionCapabilityCodecs)) {
+		NSLog(@"AsyncConnection: the peer does not support codec %d", header.codec);
+		if (header.type == AsyncConnectionTypeRequest) [self failRequestWithTag:header.blockTag code:AsyncNetworkErrorNotSupported];
+		return;
+	}
+	
+	// control frames always go out and streams are limited by the stream window
+	if (!IsControlType(header.type) && header.type != AsyncConnectionTypeStream && ![self admitFrameWithHeader:header]) return;
+	
+	// compress large bodies if the peer is able to decompress them
+	if (self.compressionEnabled && (_peerCapabilities & AsyncConnectionCapabilityCompression) && bodyData.length >= self.compressionThreshold) {
+		NSData *compressedData = [self compressData:bodyData];
+		if (compressedData) {
+			bodyData = compressedData;
+			header.flags |= AsyncConnectionFlagCompressed;
+		}
+	}
+	header.bodyLength = bodyData.length;
+	
+	// fixed headers can not describe bodies of 4 GB or more, fragments and compact headers can
+	if (header.bodyLength > UINT32_MAX && !(_peerCapabilities & (AsyncConnectionCapabilityPriorities | AsyncConnectionCapabilityCompactHeader))) {
+		NSLog(@"AsyncConnection: the peer does not support bodies of %llu bytes", header.bodyLength);
+		if (header.type == AsyncConnectionTypeRequest) [self failRequestWithTag:header.blockTag code:AsyncNetworkErrorNotSupported];
+		return;
+	}
+	
+	// control frames are urgent and responses already carry the priority of their request
+	AsyncConnectionPriority priority;
+	if (IsControlType(header.type)) {
+		priority = AsyncConnectionPriorityHigh;
+	} else if (header.type == AsyncConnectionTypeResponse) {
+		priority = PriorityOfHeader(header);
+	} else {
+		priority = [self priorityForCommand:header.command];
+	}
+	header.flags &= ~AsyncConnectionFlagPriorityMask;
+	if (_peerCapabilities & AsyncConnectionCapabilityPriorities) {
+		header.flags |= priority << AsyncConnectionFlagPriorityShift;
+	}
+	
+	// queue the frame in its lane
+	AsyncConnectionFrame *frame = [AsyncConnectionFrame new];
+	frame.header = header;
+	frame.body = bodyData;
+	if (AsyncTraceEnabled) frame.queuedTime = CFAbsoluteTimeGetCurrent();
+	[[_lanes objectAtIndex:priority] addObject:frame];
+	_laneBytes += bodyData.length;
+	_laneFrames++;
+	
+	// count
+	if (header.type == AsyncConnectionTypeMessage || header.type == AsyncConnectionTypeRequest || header.type == AsyncConnectionTypeResponse) {
+		_counters.messagesSent++;
+	}
+	if (header.type == AsyncConnectionTypeMessage || header.type == AsyncConnectionTypeRequest || header.type == AsyncConnectionTypeStream) {
+		CountCommand(_sentFramesByCommand, header.command);
+	}
+	
+	[self pumpLanes];
+	[self updateWriteWatermarks];
+}
+
+// write a frame or add it to the current batch
+- (void)writeHeader:(AsyncConnectionHeader)header body:(NSData *)bodyData;
+{
+	// the peer's hello tells us whether it reads compact headers (our own hello is always fixed)
+	NSData *headerData;
+	if (_peerCapabilities & AsyncConnectionCapabilityCompactHeader) {
+		headerData = CompactHeaderToData(header);
+	} else {
+		headerData = HeaderToData(header);
+	}
+	_counters.framesSent++;
+	
+	// send header and body in a single write (one write packet and syscall per message)
+	if (!self.batchingEnabled) {
+		[self writeFrameData:FrameData(headerData, bodyData) frameCount:1];
+		return;
+	}
+	
+	// append to the batch and flush it once it is large enough
+	[_writeBuffer appendData:headerData];
+	if (bodyData.length > 0) [_writeBuffer appendData:bodyData];
+	_writeBufferFrames++;
+	if (_writeBuffer.length >= self.batchMaxBytes) {
+		[self flush];
+	} else {
+		[self scheduleFlush];
+	}
+}
+
+// write frames to the socket
+// writes are tagged with their length, so that we know how many bytes are still queued
+// the socket completes writes in order, so the frame counts are kept in a fifo
+- (void)writeFrameData:(NSData *)data frameCount:(NSUInteger)frameCount;
+{
+	_queuedWriteBytes += data.length;
+	_queuedWriteFrames += frameCount;
+	_counters.bytesSent += data.length;
+	[_queuedWriteFrameCounts addObject:[NSNumber numberWithUnsignedInteger:frameCount]];
+	[_queuedWriteTimes addObject:[NSNumber numberWithDouble:AsyncTraceEnabled ? CFAbsoluteTimeGetCurrent() : 0]];
+	[self.socket writeData:data withTimeout:self.timeout tag:(long)data.length];
+}
+
+// apply the write policy while the write queue is at or above the high watermark
+// returns NO if the frame must not be sent
+- (BOOL)admitFrameWithHeader:(AsyncConnectionHeader)header;
+{
+	if (self.writePolicy == AsyncConnectionWritePolicyQueue || self.queuedWriteBytes < self.writeHighWatermark) return YES;
+	_droppedFrameCount++;
+	
+	// a dropped request will never receive a response
+	if (header.type == AsyncConnectionTypeRequest) {
+		[self failRequestWithTag:header.blockTag code:AsyncNetworkErrorWriteQueueFull];
+	}
+	
+	switch (self.writePolicy) {
+		case AsyncConnectionWritePolicyFail:
+			if ([self.delegate respondsToSelector:@selector(connection:didFailWithError:)]) {
+				[self.delegate connection:self didFailWithError:[NSError errorWithDomain:AsyncNetworkErrorDomain code:AsyncNetworkErrorWriteQueueFull userInfo:nil]];
+			}
+			break;
+			
+		case AsyncConnectionWritePolicyDisconnect:
+			// the socket discards its write queue and reports the disconnect
+			NSLog(@"AsyncConnection: disconnecting %@ (write queue full)", self);
+			[self.socket disconnect];
+			break;
+			
+		default:
+			break;
+	}
+	return NO;
+}
+
+// notify the delegate when the write queue crosses a watermark
+- (void)updateWriteWatermarks;
+{
+	NSUInteger queuedBytes = self.queuedWriteBytes;
+	if (!_aboveHighWatermark && queuedBytes >= self.writeHighWatermark) {
+		_aboveHighWatermark = YES;
+		if ([self.delegate respondsToSelector:@selector(connectionDidReachHighWatermark:)]) {
+			[self.delegate connectionDidReachHighWatermark:self];
+		}
+	} else if (_aboveHighWatermark && queuedBytes < self.writeLowWatermark) {
+		_aboveHighWatermark = NO;
+		if ([self.delegate respondsToSelector:@selector(connectionDidDrainToLowWatermark:)]) {
+			[self.delegate connectionDidDrainToLowWatermark:self];
+		}
+	}
+}
+
+// flush the batch at the end of the current queue turn or after the maximum delay
+- (void)scheduleFlush;
+{
+	if (_flushScheduled) return;
+	_flushScheduled = YES;
+	
+	__weak AsyncConnection *weakSelf = self;
+	if (self.batchMaxDelay > 0) {
+		dispatch_after(dispatch_time(DISPATCH_TIME_NOW, (int64_t)(self.batchMaxDelay * NSEC_PER_SEC)), self.delegateQueue, ^{
+			[weakSelf flush];
+		});
+	} else {
+		dispatch_async(self.delegateQueue, ^{
+			[weakSelf flush];
+		});
+	}
 }
 
 // send a response
-- (void)sendResponse:(id<NSCoding>)object tag:(UInt32)tag;
+- (void)sendResponse:(id<NSCoding>)object tag:(UInt32)tag priority:(AsyncConnectionPriority)priority;
 {
+	// the peer cancelled the request
+	[_incomingRequestTags removeIndex:tag];
+	if ([_cancelledRequestTags containsIndex:tag]) {
+		[_cancelledRequestTags removeIndex:tag];
+		return;
+	}
+	
 	// prepare the header
-	AsyncConnectionHeader header;
+	AsyncConnectionHeader header = {0};
 	header.type = AsyncConnectionTypeResponse;
+	header.flags = priority << AsyncConnectionFlagPriorityShift;
 	header.command = 0;
 	header.bodyLength = 0;
 	header.blockTag = tag;
@@ -264,11 +1027,403 @@ AsyncConnectionHeader DataToHeader(NSData *data);
 	[self sendHeader:header object:object];
 }
 
+// announce our capabilities to the peer
+- (void)sendHello;
+{
+	AsyncConnectionHeader header = {0};
+	header.type = AsyncConnectionTypeHello;
+	header.command = AsyncConnectionCapabilities;
+	[self sendHeader:header body:nil];
+}
+
+// send a heartbeat
+- (void)sendPing;
+{
+	AsyncConnectionHeader header = {0};
+	header.type = AsyncConnectionTypePing;
+	header.blockTag = ++_pingSequence;
+	_pingTimes[_pingSequence % AsyncConnectionPingRingSize] = CFAbsoluteTimeGetCurrent();
+	[self sendHeader:header body:nil];
+}
+
+// answer a heartbeat
+- (void)sendPongWithTag:(UInt32)tag;
+{
+	AsyncConnectionHeader header = {0};
+	header.type = AsyncConnectionTypePong;
+	header.blockTag = tag;
+	[self sendHeader:header body:nil];
+}
+
+// send a subscribe or unsubscribe frame
+- (void)sendTopic:(NSString *)topic type:(NSUInteger)type;
+{
+	AsyncConnectionHeader header = {0};
+	header.type = type;
+	header.codec = AsyncCodecIDRaw;
+	[self sendHeader:header body:[topic dataUsingEncoding:NSUTF8StringEncoding]];
+}
+
+// schedule the next heartbeat
+// heartbeats of a previous connection are discarded by comparing the generation
+- (void)scheduleHeartbeat;
+{
+	if (self.heartbeatInterval <= 0) return;
+	__weak AsyncConnection *weakSelf = self;
+	NSUInteger generation = _heartbeatGeneration;
+	dispatch_after(dispatch_time(DISPATCH_TIME_NOW, (int64_t)(self.heartbeatInterval * NSEC_PER_SEC)), self.delegateQueue, ^{
+		AsyncConnection *strongSelf = weakSelf;
+		if (strongSelf && strongSelf->_heartbeatGeneration == generation) [strongSelf heartbeat];
+	});
+}
+
+// send a ping or disconnect if too many pings went unanswered
+- (void)heartbeat;
+{
+	if (!self.socket) return;
+	if (_missedHeartbeats >= self.maxMissedHeartbeats) {
+		NSLog(@"AsyncConnection: disconnecting %@ (missed %lu heartbeats)", self, (unsigned long)_missedHeartbeats);
+		if ([self.delegate respondsToSelector:@selector(connection:didFailWithError:)]) {
+			[self.delegate connection:self didFailWithError:[NSError errorWithDomain:AsyncNetworkErrorDomain code:AsyncNetworkErrorHeartbeatTimeout userInfo:nil]];
+		}
+		_heartbeatGeneration++;
+		[self.socket disconnect];
+		return;
+	}
+	
+	_missedHeartbeats++;
+	[self sendPing];
+	[self scheduleHeartbeat];
+}
+
+// smooth the round trip time and its deviation like TCP does (RFC 6298)
+- (void)updateRoundTripTime:(NSTimeInterval)sample;
+{
+	_lastRoundTripTime = sample;
+	if (_roundTripTime == 0) {
+		_roundTripTime = sample;
+		_roundTripTimeJitter = sample / 2;
+	} else {
+		_roundTripTimeJitter = 0.75 * _roundTripTimeJitter + 0.25 * fabs(_roundTripTime - sample);
+		_roundTripTime = 0.875 * _roundTripTime + 0.125 * sample;
+	}
+	if ([self.delegate respondsToSelector:@selector(connection:didUpdateRoundTripTime:)]) {
+		[self.delegate connection:self didUpdateRoundTripTime:_roundTripTime];
+	}
+}
+
+// add the round trip time of a request to the histogram of its command
+- (void)recordLatency:(NSTimeInterval)latency forCommand:(AsyncCommand)command;
+{
+	NSNumber *key = [NSNumber numberWithUnsignedInt:command];
+	AsyncLatencyHistogram *histogram = [_latencyHistograms objectForKey:key];
+	if (!histogram) {
+		histogram = [AsyncLatencyHistogram new];
+		[_latencyHistograms setObject:histogram forKey:key];
+	}
+	[histogram recordLatency:latency];
+}
+
+// choose the lane that writes next
+// the high priority lane always goes first, normal and low priority lanes take turns by weight
+- (NSMutableArray *)nextLane;
+{
+	NSMutableArray *high = [_lanes objectAtIndex:AsyncConnectionPriorityHigh];
+	NSMutableArray *normal = [_lanes objectAtIndex:AsyncConnectionPriorityNormal];
+	NSMutableArray *low = [_lanes objectAtIndex:AsyncConnectionPriorityLow];
+	if (high.count > 0) return high;
+	if (normal.count == 0) return low.count > 0 ? low : nil;
+	if (low.count == 0) return normal;
+	
+	// both lanes are busy
+	if (_laneCredit > 0) {
+		_laneCredit--;
+		return normal;
+	}
+	_laneCredit = AsyncConnectionNormalLaneWeight;
+	return low;
+}
+
+// hand fragments to the socket until the write window is full
+// everything else waits in the lanes, so that urgent frames can overtake bulk frames
+- (void)pumpLanes;
+{
+	// frames wait while the address families race, the socket that connects first sends them
+	if (_alternateSocket || _alternateAddress) return;
+	while (self.socket && (NSUInteger)_queuedWriteBytes + _writeBuffer.length < self.writeWindowSize) {
+		NSMutableArray *lane = [self nextLane];
+		if (!lane) break;
+		[self writeFragmentFromLane:lane];
+	}
+}
+
+// write the next fragment of the first frame in a lane
+// bodies are only split if the peer is able to reassemble them
+- (void)writeFragmentFromLane:(NSMutableArray *)lane;
+{
+	AsyncConnectionFrame *frame = [lane objectAtIndex:0];
+	AsyncConnectionHeader header = frame.header;
+	NSData *body = frame.body;
+	NSUInteger length = body.length - frame.offset;
+	if ((_peerCapabilities & AsyncConnectionCapabilityPriorities) && length > self.fragmentSize) {
+		length = MAX(self.fragmentSize, 1);
+		header.flags |= AsyncConnectionFlagMore;
+	}
+	
+	NSData *fragment = body;
+	if (length != body.length) fragment = [body subdataWithRange:NSMakeRange(frame.offset, length)];
+	header.bodyLength = length;
+	frame.offset += length;
+	_laneBytes -= length;
+	if (frame.offset == body.length) {
+		if (frame.queuedTime > 0) AsyncTraceRecord("lane", (__bridge void *)self, header.command, header.blockTag, frame.queuedTime, CFAbsoluteTimeGetCurrent());
+		[lane removeObjectAtIndex:0];
+		_laneFrames--;
+	}
+	
+	[self writeHeader:header body:fragment];
+}
+
+// drop all frames waiting in the lanes and all partially received bodies
+- (void)resetLanes;
+{
+	for (NSMutableArray *lane in _lanes) [lane removeAllObjects];
+	for (NSMutableData *fragments in _fragmentBuffers) [fragments setLength:0];
+	_laneBytes = 0;
+	_laneFrames = 0;
+	_laneCredit = 0;
+}
+
+// forget the cached addresses of the endpoint
+- (void)invalidateCachedAddresses;
+{
+	if (self.netService) {
+		[self.addressCache invalidateNetService:self.netService];
+	} else if (self.host) {
+		[self.addressCache invalidateHost:self.host port:self.port];
+	}
+}
+
+// remove a frame that was not written at all from its lane
+- (BOOL)removeQueuedFrameWithType:(NSUInteger)type tag:(UInt32)tag;
+{
+	for (NSMutableArray *lane in _lanes) {
+		for (NSUInteger i = 0; i < lane.count; i++) {
+			AsyncConnectionFrame *frame = [lane objectAtIndex:i];
+			if (frame.header.type != type || frame.header.blockTag != tag || frame.offset > 0) continue;
+			_laneBytes -= frame.body.length;
+			_laneFrames--;
+			[lane removeObjectAtIndex:i];
+			[self updateWriteWatermarks];
+			return YES;
+		}
+	}
+	return NO;
+}
+
+// send chunks of the outgoing streams until the stream window is full
+// this keeps the memory used by streams bounded no matter how large they are
+- (void)pumpStreams;
+{
+	if (!(_peerCapabilities & AsyncConnectionCapabilityStreaming)) return;
+	NSUInteger window = MIN(self.streamWindowSize, self.writeHighWatermark);
+	while (_outgoingStreams.count > 0 && self.socket && self.queuedWriteBytes < window) {
+		
+		// streams take turns
+		AsyncConnectionStream *stream = [_outgoingStreams objectAtIndex:0];
+		[_outgoingStreams removeObjectAtIndex:0];
+		NSData *chunk = stream.producer();
+		
+		AsyncConnectionHeader header = {0};
+		header.type = AsyncConnectionTypeStream;
+		header.codec = AsyncCodecIDRaw;
+		header.command = stream.command;
+		header.blockTag = stream.streamID;
+		if (chunk) {
+			[_outgoingStreams addObject:stream];
+		} else {
+			header.flags |= AsyncConnectionFlagFinal;
+		}
+		[self sendHeader:header body:chunk];
+	}
+}
+
+// drop all outgoing streams and report an error if the code is set
+- (void)cancelStreamsWithCode:(NSInteger)code;
+{
+	if (_outgoingStreams.count == 0) return;
+	[_outgoingStreams removeAllObjects];
+	if (code && [self.delegate respondsToSelector:@selector(connection:didFailWithError:)]) {
+		[self.delegate connection:self didFailWithError:[NSError errorWithDomain:AsyncNetworkErrorDomain code:code userInfo:nil]];
+	}
+}
+
+// compress data with zlib, the result starts with the uncompressed length
+// returns nil if compression does not make the data smaller or the length does not fit
+- (NSData *)compressData:(NSData *)data;
+{
+	if (data.length > UINT32_MAX) return nil;
+	CFAbsoluteTime start = CFAbsoluteTimeGetCurrent();
+	uLongf compressedLength = compressBound((uLong)data.length);
+	NSMutableData *compressedData = [NSMutableData dataWithLength:sizeof(UInt32) + compressedLength];
+	UInt32 length = CFSwapInt32HostToLittle((UInt32)data.length);
+	memcpy(compressedData.mutableBytes, &length, sizeof(length));
+	int result = compress2((Bytef *)compressedData.mutableBytes + sizeof(UInt32), &compressedLength, data.bytes, (uLong)data.length, Z_DEFAULT_COMPRESSION);
+	CFAbsoluteTime end = CFAbsoluteTimeGetCurrent();
+	_compressionTime += end - start;
+	AsyncTraceRecord("compress", (__bridge void *)self, 0, 0, start, end);
+	
+	if (result != Z_OK || sizeof(UInt32) + compressedLength >= data.length) return nil;
+	[compressedData setLength:sizeof(UInt32) + compressedLength];
+	_uncompressedBytesSent += data.length;
+	_compressedBytesSent += compressedData.length;
+	return compressedData;
+}
+
+// decompress a body created by compressData:
+- (NSData *)decompressBytes:(const UInt8 *)bytes length:(NSUInteger)length;
+{
+	if (length < sizeof(UInt32)) return nil;
+	CFAbsoluteTime start = CFAbsoluteTimeGetCurrent();
+	UInt32 uncompressedLength;
+	memcpy(&uncompressedLength, bytes, sizeof(uncompressedLength));
+	uLongf decompressedLength = CFSwapInt32LittleToHost(uncompressedLength);
+	
+	// zlib can not expand data by more than about 1032:1, anything beyond that or our limit is bogus
+	if (decompressedLength > self.maxBodySize || decompressedLength / 1032 > length) {
+		NSLog(@"AsyncConnection: could not decompress body: claimed length %lu is too large", (unsigned long)decompressedLength);
+		return nil;
+	}
+	NSMutableData *data = [NSMutableData dataWithLength:decompressedLength];
+	int result = uncompress(data.mutableBytes, &decompressedLength, bytes + sizeof(UInt32), (uLong)(length - sizeof(UInt32)));
+	CFAbsoluteTime end = CFAbsoluteTimeGetCurrent();
+	_decompressionTime += end - start;
+	AsyncTraceRecord("decompress", (__bridge void *)self, 0, 0, start, end);
+	
+	if (result != Z_OK) {
+		NSLog(@"AsyncConnection: could not decompress body: %d", result);
+		return nil;
+	}
+	[data setLength:decompressedLength];
+	return data;
+}
+
+// decode the body that follows the header
+- (id)objectWithHeader:(AsyncConnectionHeader)header bytes:(const UInt8 *)bytes;
+{
+	NSData *bodyData;
+	if (header.flags & AsyncConnectionFlagCompressed) {
+		bodyData = [self decompressBytes:bytes length:header.bodyLength];
+		if (!bodyData) return nil;
+		
+		// raw data is passed on as is
+		if (header.codec == AsyncCodecIDRaw) return bodyData;
+	} else {
+		// raw data is passed on as is (copied out of the read buffer)
+		if (header.codec == AsyncCodecIDRaw) return [NSData dataWithBytes:bytes length:header.bodyLength];
+		
+		// decode directly from the read buffer
+		if (header.bodyLength == 0) return nil;
+		bodyData = [NSData dataWithBytesNoCopy:(void *)bytes length:header.bodyLength freeWhenDone:NO];
+	}
+	
+	id<AsyncCodec> codec = AsyncCodecForID(header.codec);
+	if (!codec) {
+		NSLog(@"AsyncConnection: ignoring body with unknown codec: %d", header.codec);
+		return nil;
+	}
+	CFAbsoluteTime start = CFAbsoluteTimeGetCurrent();
+	id object = [codec decodeData:bodyData];
+	CFAbsoluteTime end = CFAbsoluteTimeGetCurrent();
+	_counters.decodeTime += end - start;
+	AsyncTraceRecord("decode", (__bridge void *)self, header.command, header.blockTag, start, end);
+	return object;
+}
+
 // get a response from the delegate for the given header and object
 - (void)respondToMessageWithHeader:(AsyncConnectionHeader)header object:(id<NSCoding>)object;
 {
+	// count
+	if (header.type == AsyncConnectionTypeMessage || header.type == AsyncConnectionTypeRequest || header.type == AsyncConnectionTypeResponse) {
+		_counters.messagesReceived++;
+	}
+	if (header.type == AsyncConnectionTypeMessage || header.type == AsyncConnectionTypeRequest || header.type == AsyncConnectionTypeStream) {
+		CountCommand(_receivedFramesByCommand, header.command);
+	}
+	
 	AsyncNetworkResponseBlock block;
+	AsyncCommand command;
+	CFAbsoluteTime sendTime;
+	NSString *topic;
+	CFAbsoluteTime start = AsyncTraceEnabled ? CFAbsoluteTimeGetCurrent() : 0;
 	switch (header.type) {
+		case AsyncConnectionTypeHello:
+			// the peer announced its capabilities
+			_peerCapabilities = header.command;
+			if (_connectedTime > 0) _counters.handshakeTime = CFAbsoluteTimeGetCurrent() - _connectedTime;
+			if (!(_peerCapabilities & AsyncConnectionCapabilityStreaming)) {
+				[self cancelStreamsWithCode:AsyncNetworkErrorNotSupported];
+			}
+			[self pumpStreams];
+			
+			// start the heartbeat
+			if (_peerCapabilities & AsyncConnectionCapabilityHeartbeat) {
+				_missedHeartbeats = 0;
+				memset(_pingTimes, 0, sizeof(_pingTimes));
+				[self scheduleHeartbeat];
+			}
+			
+			// (re-)subscribe to our topics
+			if (_peerCapabilities & AsyncConnectionCapabilityTopics) {
+				for (NSString *subscribedTopic in _subscribedTopics) {
+					[self sendTopic:subscribedTopic type:AsyncConnectionTypeSubscribe];
+				}
+			}
+			break;
+			
+		case AsyncConnectionTypeSubscribe:
+			// the peer subscribed to a topic
+			topic = [object isKindOfClass:[NSData class]] ? [[NSString alloc] initWithData:(NSData *)object encoding:NSUTF8StringEncoding] : nil;
+			if (topic.length == 0 || [_peerTopics containsObject:topic]) break;
+			[_peerTopics addObject:topic];
+			if ([self.delegate respondsToSelector:@selector(connection:didSubscribeToTopic:)]) {
+				[self.delegate connection:self didSubscribeToTopic:topic];
+			}
+			break;
+			
+		case AsyncConnectionTypeUnsubscribe:
+			// the peer unsubscribed from a topic
+			topic = [object isKindOfClass:[NSData class]] ? [[NSString alloc] initWithData:(NSData *)object encoding:NSUTF8StringEncoding] : nil;
+			if (!topic || ![_peerTopics containsObject:topic]) break;
+			[_peerTopics removeObject:topic];
+			if ([self.delegate respondsToSelector:@selector(connection:didUnsubscribeFromTopic:)]) {
+				[self.delegate connection:self didUnsubscribeFromTopic:topic];
+			}
+			break;
+			
+		case AsyncConnectionTypePing:
+			[self sendPongWithTag:header.blockTag];
+			break;
+			
+		case AsyncConnectionTypePong:
+			// any outstanding ping counts (a late pong measures the round trip of its own ping)
+			if (_pingSequence - header.blockTag < AsyncConnectionPingRingSize) {
+				CFAbsoluteTime *pingTime = &_pingTimes[header.blockTag % AsyncConnectionPingRingSize];
+				if (*pingTime <= 0) break;
+				_missedHeartbeats = 0;
+				[self updateRoundTripTime:CFAbsoluteTimeGetCurrent() - *pingTime];
+				*pingTime = 0;
+			}
+			break;
+			
+		case AsyncConnectionTypeStream:
+			// a chunk of an incoming stream
+			if ([self.delegate respondsToSelector:@selector(connection:didReceiveChunk:forCommand:stream:finished:)]) {
+				[self.delegate connection:self didReceiveChunk:object forCommand:header.command stream:header.blockTag finished:(header.flags & AsyncConnectionFlagFinal) != 0];
+			}
+			break;
+			
+
 		case AsyncConnectionTypeMessage:
 			// a message requires no response
 			if ([self.delegate respondsToSelector:@selector(connection:didReceiveCommand:object:)]) {
@@ -276,22 +1431,132 @@ AsyncConnectionHeader DataToHeader(NSData *data);
 			}
 			break;
 			
+		case AsyncConnectionTypeCancel:
+			// the peer is no longer interested in the response
+			if (![_incomingRequestTags containsIndex:header.blockTag]) {
+				[self removeQueuedFrameWithType:AsyncConnectionTypeResponse tag:header.blockTag];
+			} else {
+				[_cancelledRequestTags addIndex:header.blockTag];
+			}
+			break;
+			
 		case AsyncConnectionTypeRequest:
 			// a request requires a response
+			[_incomingRequestTags addIndex:header.blockTag];
 			if ([self.delegate respondsToSelector:@selector(connection:didReceiveCommand:object:responseBlock:)]) {
 				[self.delegate connection:self didReceiveCommand:header.command object:object responseBlock:^(id<NSCoding> response) {
-					[self sendResponse:response tag:header.blockTag];
+					[self sendResponse:response tag:header.blockTag priority:PriorityOfHeader(header)];
 				}];
 			} else {
-				[self sendResponse:nil tag:header.blockTag];
+				[self sendResponse:nil tag:header.blockTag priority:PriorityOfHeader(header)];
 			}
 			break;
 			
 		case AsyncConnectionTypeResponse:
 			// a response to a request does not require a response
-			block = [_responseBlocks objectForKey:[NSNumber numberWithInteger:header.blockTag]];
-			if (block) block(object);
+			block = [_pendingRequests removeResponseBlockForTag:header.blockTag command:&command sendTime:&sendTime];
+			if (block) {
+				CFAbsoluteTime now = CFAbsoluteTimeGetCurrent();
+				[self recordLatency:now - sendTime forCommand:command];
+				AsyncTraceRecord("request", (__bridge void *)self, command, header.blockTag, sendTime, now);
+				block(object);
+			}
+			break;
+	}
+	
+	// time spent in the delegate or response block
+	if (start > 0) AsyncTraceRecord("deliver", (__bridge void *)self, header.command, header.blockTag, start, CFAbsoluteTimeGetCurrent());
+}
+
+// start reading frames and announce our capabilities
+- (void)startReceiving;
+{
+	_receiving = YES;
+	[self readFrames];
+	[self sendHello];
+}
+
+// read all bytes that are available into the read buffer
+- (void)readFrames;
+{
+	[self.socket readDataWithTimeout:self.timeout buffer:_readBuffer bufferOffset:_readBuffer.length tag:AsyncConnectionFrameTag];
+}
+
+// decode and respond to all complete frames in the read buffer
+- (void)processReadBuffer;
+{
+	const UInt8 *bytes = _readBuffer.bytes;
+	NSUInteger length = _readBuffer.length;
+	NSUInteger offset = 0;
+	NSUInteger missing = 0;
+	
+	// the delegate may cancel the connection while we are responding
+	while (self.socket) {
+		
+		// wait for a complete header
+		AsyncConnectionHeader header;
+		NSInteger headerLength = ParseHeader(bytes + offset, length - offset, &header);
+		if (headerLength == 0) break;
+		_counters.framesReceived++;
+		
+		// older peers send uninitialized struct padding where codec and flags are (their frames are keyed archives)
+		if (!(_peerCapabilities & AsyncConnectionCapabilityCodecs)) {
+			header.codec = AsyncCodecIDKeyedArchiver;
+			header.flags = 0;
+		}
+		
+		// we can not recover from a malformed header or a body larger than the address space
+		if (headerLength < 0 || header.bodyLength > NSUIntegerMax - headerLength) {
+			NSLog(@"AsyncConnection: disconnecting %@ (malformed header)", self);
+			[self.socket disconnect];
+			return;
+		}
+		
+		// do not buffer bodies we would reject anyway
+		NSMutableData *fragments = [_fragmentBuffers objectAtIndex:PriorityOfHeader(header)];
+		if (header.bodyLength > self.maxBodySize || fragments.length > self.maxBodySize - (NSUInteger)header.bodyLength) {
+			NSLog(@"AsyncConnection: disconnecting %@ (malformed frame: body larger than %lu bytes)", self, (unsigned long)self.maxBodySize);
+			[self.socket disconnect];
+			return;
+		}
+		
+		// wait for the complete body
+		NSUInteger frameLength = headerLength + (NSUInteger)header.bodyLength;
+		if (length - offset < frameLength) {
+			missing = frameLength - (length - offset);
 			break;
+		}
+		
+		const UInt8 *body = bytes + offset + headerLength;
+		offset += frameLength;
+		
+		// reassemble fragmented bodies (there is at most one per priority lane)
+		if ((header.flags & AsyncConnectionFlagMore) || fragments.length > 0) {
+			[fragments appendBytes:body length:(NSUInteger)header.bodyLength];
+			if (header.flags & AsyncConnectionFlagMore) continue;
+			header.bodyLength = fragments.length;
+			id object = [self objectWithHeader:header bytes:fragments.bytes];
+			[fragments setLength:0];
+			[self respondToMessageWithHeader:header object:object];
+			continue;
+		}
+		
+		// decode the body
+		id object = [self objectWithHeader:header bytes:body];
+		
+		// respond
+		[self respondToMessageWithHeader:header object:object];
+	}
+	
+	// drop the consumed frames and keep any partial frame for the next read
+	if (offset > 0) [_readBuffer replaceBytesInRange:NSMakeRange(0, offset) withBytes:NULL length:0];
+	if (!self.socket) return;
+	
+	// read the remainder of an incomplete body in one go or whatever comes next
+	if (missing > 0) {
+		[self.socket readDataToLength:missing withTimeout:self.timeout buffer:_readBuffer bufferOffset:_readBuffer.length tag:AsyncConnectionFrameTag];
+	} else {
+		[self readFrames];
 	}
 }
 
@@ -301,10 +1566,25 @@ AsyncConnectionHeader DataToHeader(NSData *data);
 // net service did resolve
 - (void)netServiceDidResolveAddress:(NSNetService *)sender;
 {
-	_host = self.netService.hostName;
-	_port = self.netService.port;
 	self.netService.delegate = nil;
-	[self start];
+	[self.addressCache setAddresses:sender.addresses forNetService:self.netService];
+	[self performBlock:^{
+		_host = self.netService.hostName;
+		_port = self.netService.port;
+		[self start];
+	}];
+}
+
+// net service could not be resolved
+- (void)netService:(NSNetService *)sender didNotResolve:(NSDictionary *)errorDict;
+{
+	self.netService.delegate = nil;
+	NSError *error = [NSError errorWithDomain:@"NSNetService" code:-1 userInfo:errorDict];
+	[self performBlock:^{
+		if ([self.delegate respondsToSelector:@selector(connection:didFailWithError:)]) {
+			[self.delegate connection:self didFailWithError:error];
+		}
+	}];
 }
 
 
@@ -315,8 +1595,27 @@ AsyncConnectionHeader DataToHeader(NSData *data);
  **/
 - (void)socket:(GCDAsyncSocket *)sock didConnectToHost:(NSString *)host port:(uint16_t)port;
 {
-	// start reading length data
-	[self.socket readDataToLength:AsyncConnectionHeaderSize withTimeout:self.timeout tag:AsyncConnectionHeaderTag];
+	// ignore a previous socket
+	if (sock != self.socket && sock != _alternateSocket) return;
+	
+	// the first socket of a race wins and the other one is closed
+	GCDAsyncSocket *loser = (sock == self.socket) ? _alternateSocket : self.socket;
+	_socket = sock;
+	_alternateSocket = nil;
+	_alternateAddress = nil;
+	[loser disconnect];
+	
+	_connectedTime = CFAbsoluteTimeGetCurrent();
+	_counters.connectTime = _connectedTime - _startTime;
+	
+	// a net service connected to its cached addresses was not resolved
+	if (!_host) {
+		_host = host;
+		_port = port;
+	}
+	
+	// start reading frames and announce our capabilities
+	[self startReceiving];
 	
 	// inform delegate that we are connected
 	if ([self.delegate respondsToSelector:@selector(connectionDidConnect:)]) {
@@ -331,7 +1630,25 @@ AsyncConnectionHeader DataToHeader(NSData *data);
  **/
 - (void)socketDidDisconnect:(GCDAsyncSocket *)sock withError:(NSError *)error;
 {
+	// the other family lost the race on its own
+	if (sock == _alternateSocket) {
+		_alternateSocket = nil;
+		return;
+	}
+	
+	// a cancelled socket was already cleaned up by cancel
+	if (sock != self.socket) return;
+	
+	// the other family may still connect
+	if (_connectedTime == 0 && [self failOverToAlternateAddress]) return;
+	
+	[self failAllRequestsWithCode:AsyncNetworkErrorDisconnected];
+	[self cancelStreamsWithCode:0];
+	[self resetLanes];
+	_heartbeatGeneration++;
 	if (error) {
+		// the cached addresses may be stale
+		if (_connectedTime == 0) [self invalidateCachedAddresses];
 		if ([self.delegate respondsToSelector:@selector(connection:didFailWithError:)]) {
 			[self.delegate connection:self didFailWithError:error];
 		}
@@ -347,27 +1664,15 @@ AsyncConnectionHeader DataToHeader(NSData *data);
  **/
 - (void)socket:(GCDAsyncSocket *)sock didReadData:(NSData *)data withTag:(long)tag;
 {
-    id object;
+	// ignore reads of a previous socket
+	if (sock != self.socket) return;
+	
+	_counters.bytesReceived += data.length;
 	switch(tag) {
 			
-		// header
-		case AsyncConnectionHeaderTag:
-			_lastHeader = DataToHeader(data);
-			if (_lastHeader.bodyLength > 0) {
-				// load the body data
-				[self.socket readDataToLength:_lastHeader.bodyLength withTimeout:self.timeout tag:AsyncConnectionBodyTag];
-			} else {
-				// respond
-				[self respondToMessageWithHeader:_lastHeader object:nil];
-				[self.socket readDataToLength:AsyncConnectionHeaderSize withTimeout:self.timeout tag:AsyncConnectionHeaderTag];
-			}
-			break;
-
-		// body
-		case AsyncConnectionBodyTag:
-            object = [NSKeyedUnarchiver unarchiveObjectWithData:data];
-			[self respondToMessageWithHeader:_lastHeader object:object];
-			[self.socket readDataToLength:AsyncConnectionHeaderSize withTimeout:self.timeout tag:AsyncConnectionHeaderTag];
+		// frames (the data was appended to the read buffer)
+		case AsyncConnectionFrameTag:
+			[self processReadBuffer];
 			break;
 
 		// unknown tag
@@ -376,31 +1681,169 @@ AsyncConnectionHeader DataToHeader(NSData *data);
 	}
 }
 
+/**
+ * Called when a socket has completed writing the requested data. Not called if there is an error.
+ **/
+- (void)socket:(GCDAsyncSocket *)sock didWriteDataWithTag:(long)tag;
+{
+	// ignore writes of a previous socket
+	if (sock != self.socket) return;
+	
+	// the tag is the length of the write
+	_queuedWriteBytes -= tag;
+	if (_queuedWriteFrameCounts.count > 0) {
+		NSUInteger frameCount = [[_queuedWriteFrameCounts objectAtIndex:0] unsignedIntegerValue];
+		CFAbsoluteTime writeTime = [[_queuedWriteTimes objectAtIndex:0] doubleValue];
+		_queuedWriteFrames -= frameCount;
+		[_queuedWriteFrameCounts removeObjectAtIndex:0];
+		[_queuedWriteTimes removeObjectAtIndex:0];
+		
+		// time in the socket's write queue (the tag of the event is the number of frames)
+		if (writeTime > 0) AsyncTraceRecord("write", (__bridge void *)self, 0, (UInt32)frameCount, writeTime, CFAbsoluteTimeGetCurrent());
+	}
+	[self pumpLanes];
+	[self updateWriteWatermarks];
+	[self pumpStreams];
+}
+
 
 @end
 
 // convert a header to data
+// the fixed header is encoded as four little endian UInt32 fields (type|codec|flags, command, blockTag, bodyLength)
 NSData *HeaderToData(AsyncConnectionHeader header)
 {
-	static size_t size = 4 * sizeof(UInt32);
-	UInt32 *encodedHeader = malloc(size);
-	encodedHeader[0] = CFSwapInt16LittleToHost(header.type);
-	encodedHeader[1] = CFSwapInt32LittleToHost(header.command);
-	encodedHeader[2] = CFSwapInt32LittleToHost(header.blockTag);
-	encodedHeader[3] = CFSwapInt32LittleToHost(header.bodyLength);
-	return [NSData dataWithBytesNoCopy:encodedHeader length:size freeWhenDone:YES];
+	UInt32 encodedHeader[4];
+	encodedHeader[0] = CFSwapInt32HostToLittle(header.type | (UInt32)header.codec << 16 | (UInt32)header.flags << 24);
+	encodedHeader[1] = CFSwapInt32HostToLittle(header.command);
+	encodedHeader[2] = CFSwapInt32HostToLittle(header.blockTag);
+	encodedHeader[3] = CFSwapInt32HostToLittle((UInt32)header.bodyLength);
+	return [NSData dataWithBytes:encodedHeader length:sizeof(encodedHeader)];
 }
 
-// convert raw data to a header
-AsyncConnectionHeader DataToHeader(NSData *data)
+// convert a header to data in the compact format
+// marker|version|type, flags and codec bytes followed by command, blockTag and bodyLength as little endian varints
+// a message without body and command takes 6 bytes instead of 16
+NSData *CompactHeaderToData(AsyncConnectionHeader header)
 {
-	assert(data.length == 4 * sizeof(UInt32));
+	NSMutableData *data = [NSMutableData dataWithCapacity:AsyncConnectionCompactHeaderMaxSize];
+	UInt8 bytes[3];
+	bytes[0] = AsyncConnectionCompactHeaderMarker | AsyncConnectionCompactHeaderVersion << 5 | (header.type & 0x1F);
+	bytes[1] = header.flags;
+	bytes[2] = header.codec;
+	[data appendBytes:bytes length:sizeof(bytes)];
+	AsyncNetworkAppendVarint(data, header.command);
+	AsyncNetworkAppendVarint(data, header.blockTag);
+	AsyncNetworkAppendVarint(data, header.bodyLength);
+	return data;
+}
+
+// convert raw bytes to a header
+AsyncConnectionHeader BytesToHeader(const void *bytes)
+{
+	UInt32 encodedHeader[4];
+	memcpy(encodedHeader, bytes, sizeof(encodedHeader));
 	
-	const UInt32 *encodedHeader = (const UInt32 *)data.bytes;
 	AsyncConnectionHeader header;
-	header.type       = CFSwapInt16LittleToHost(encodedHeader[0]);
+	UInt32 typeCodecFlags = CFSwapInt32LittleToHost(encodedHeader[0]);
+	header.type       = (UInt16)typeCodecFlags;
+	header.codec      = (AsyncCodecID)(typeCodecFlags >> 16);
+	header.flags      = (UInt8)(typeCodecFlags >> 24);
 	header.command    = CFSwapInt32LittleToHost(encodedHeader[1]);
 	header.blockTag   = CFSwapInt32LittleToHost(encodedHeader[2]);
 	header.bodyLength = CFSwapInt32LittleToHost(encodedHeader[3]);
 	return header;
 }
+
+// parse a fixed or compact header
+// returns the length of the header, 0 if it is incomplete or -1 if it is malformed
+NSInteger ParseHeader(const UInt8 *bytes, NSUInteger length, AsyncConnectionHeader *header)
+{
+	if (length == 0) return 0;
+	
+	// fixed header
+	if (!(bytes[0] & AsyncConnectionCompactHeaderMarker)) {
+		if (length < AsyncConnectionHeaderSize) return 0;
+		*header = BytesToHeader(bytes);
+		return AsyncConnectionHeaderSize;
+	}
+	
+	// compact header
+	if (((bytes[0] >> 5) & 0x03) != AsyncConnectionCompactHeaderVersion) return -1;
+	if (length < 3) return 0;
+	NSUInteger offset = 3;
+	UInt64 command, blockTag, bodyLength;
+	if (!AsyncNetworkReadVarint(bytes, length, &offset, &command) ||
+		!AsyncNetworkReadVarint(bytes, length, &offset, &blockTag) ||
+		!AsyncNetworkReadVarint(bytes, length, &offset, &bodyLength)) {
+		return (length < AsyncConnectionCompactHeaderMaxSize) ? 0 : -1;
+	}
+	if (command > UINT32_MAX || blockTag > UINT32_MAX) return -1;
+	
+	header->type       = bytes[0] & 0x1F;
+	header->flags      = bytes[1];
+	header->codec      = bytes[2];
+	header->command    = (AsyncCommand)command;
+	header->blockTag   = (UInt32)blockTag;
+	header->bodyLength = bodyLength;
+	return (NSInteger)offset;
+}
+
+// the priority lane of a frame (unknown values are treated as normal)
+AsyncConnectionPriority PriorityOfHeader(AsyncConnectionHeader header)
+{
+	NSUInteger priority = (header.flags & AsyncConnectionFlagPriorityMask) >> AsyncConnectionFlagPriorityShift;
+	if (priority > AsyncConnectionPriorityLow) return AsyncConnectionPriorityNormal;
+	return (AsyncConnectionPriority)priority;
+}
+
+// control frames bypass the write policy and use the high priority lane
+BOOL IsControlType(NSUInteger type)
+{
+	return type == AsyncConnectionTypeHello || type == AsyncConnectionTypePing || type == AsyncConnectionTypePong || type == AsyncConnectionTypeSubscribe || type == AsyncConnectionTypeUnsubscribe || type == AsyncConnectionTypeCancel;
+}
+
+// count a frame of a command
+void CountCommand(NSMutableDictionary *counts, AsyncCommand command)
+{
+	NSNumber *key = [NSNumber numberWithUnsignedInt:command];
+	UInt64 count = [[counts objectForKey:key] unsignedLongLongValue];
+	[counts setObject:[NSNumber numberWithUnsignedLongLong:count + 1] forKey:key];
+}
+
+// add counters to a total
+void AsyncConnectionAddCounters(AsyncConnectionCounters *total, AsyncConnectionCounters counters)
+{
+	total->messagesSent      += counters.messagesSent;
+	total->messagesReceived  += counters.messagesReceived;
+	total->framesSent        += counters.framesSent;
+	total->framesReceived    += counters.framesReceived;
+	total->bytesSent         += counters.bytesSent;
+	total->bytesReceived     += counters.bytesReceived;
+	total->encodeTime        += counters.encodeTime;
+	total->decodeTime        += counters.decodeTime;
+	total->queuedWriteBytes  += counters.queuedWriteBytes;
+	total->queuedWriteFrames += counters.queuedWriteFrames;
+	total->pendingRequests   += counters.pendingRequests;
+	total->connectTime       += counters.connectTime;
+	total->handshakeTime     += counters.handshakeTime;
+	total->connections       += counters.connections;
+}
+
+// add counts by command to a total
+void AsyncConnectionAddCommandCounts(NSMutableDictionary *total, NSDictionary *counts)
+{
+	for (NSNumber *command in counts) {
+		UInt64 count = [[total objectForKey:command] unsignedLongLongValue] + [[counts objectForKey:command] unsignedLongLongValue];
+		[total setObject:[NSNumber numberWithUnsignedLongLong:count] forKey:command];
+	}
+}
+
+// assemble header and body into one contiguous frame
+NSData *FrameData(NSData *headerData, NSData *body)
+{
+	NSMutableData *frame = [NSMutableData dataWithCapacity:headerData.length + body.length];
+	[frame appendData:headerData];
+	if (body.length > 0) [frame appendData:body];
+	return frame;
+}
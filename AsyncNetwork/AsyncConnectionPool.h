@@ -0,0 +1,59 @@
+/**
+ * Copyright (C) 2011 Jonathan Diehl
+ * 
+ * Permission is hereby granted, free of charge, to any person obtaining a copy of
+ * this software and associated documentation files (the "Software"), to deal in
+ * the Software without restriction, including without limitation the rights to
+ * use, copy, modify, merge, publish, distribute, sublicense, and/or sell copies
+ * of the Software, and to permit persons to whom the Software is furnished to do
+ * so, subject to the following conditions:
+ * 
+ * The above copyright notice and this permission notice shall be included in all
+ * copies or substantial portions of the Software.
+ * 
+ * THE SOFTWARE IS PROVIDED "AS IS", WITHOUT WARRANTY OF ANY KIND, EXPRESS OR
+ * IMPLIED, INCLUDING BUT NOT LIMITED TO THE WARRANTIES OF MERCHANTABILITY,
+ * FITNESS FOR A PARTICULAR PURPOSE AND NONINFRINGEMENT. IN NO EVENT SHALL THE
+ * AUTHORS OR COPYRIGHT HOLDERS BE LIABLE FOR ANY CLAIM, DAMAGES OR OTHER
+ * LIABILITY, WHETHER IN AN ACTION OF CONTRACT, TORT OR OTHERWISE, ARISING FROM,
+ * OUT OF OR IN CONNECTION WITH THE SOFTWARE OR THE USE OR OTHER DEALINGS IN THE
+ * SOFTWARE.
+ * 
+ * https://github.com/jdiehl/async-network
+ */
+
+#import <Foundation/Foundation.h>
+#import "AsyncConnection.h"
+
+/**
+ @brief A pool of connections that requests to the same endpoint share and keep open
+ @details Requests to a host and port (or net service) are sent over up to maxConnectionsPerEndpoint
+ connections, each carrying up to maxRequestsPerConnection requests at once (responses are matched by tag).
+ Connections without pending requests stay open for idleTimeout, at most maxIdleConnections of them
+ (the least recently used are closed first). All pooled connections call back on the delegate queue of the pool.
+ */
+@interface AsyncConnectionPool : NSObject <AsyncConnectionDelegate>
+
+@property (strong, nonatomic) dispatch_queue_t delegateQueue; // queue of the pooled connections (default: AsyncNetworkDispatchQueue())
+@property (assign) NSUInteger maxConnectionsPerEndpoint;  // connections opened to the same endpoint
+@property (assign) NSUInteger maxRequestsPerConnection;   // pending requests on a connection before another one is opened
+@property (assign) NSUInteger maxIdleConnections;         // idle connections kept open in total
+@property (assign) NSTimeInterval idleTimeout;            // idle connections are closed after this time
+@property (readonly) NSUInteger connectionCount;          // open and opening connections
+
+// the pool used by AsyncRequest by default
++ (AsyncConnectionPool *)sharedPool;
+
+// the response block receives an NSError (AsyncNetworkErrorDomain) if the request times out or the connection fails
+// the timeout includes the time spent waiting for a new connection to connect (negative: no timeout)
+// returns an opaque request that can be cancelled
+- (id)sendCommand:(AsyncCommand)command object:(id<NSCoding>)object toHost:(NSString *)host port:(NSUInteger)port timeout:(NSTimeInterval)timeout responseBlock:(AsyncNetworkResponseBlock)block;
+- (id)sendCommand:(AsyncCommand)command object:(id<NSCoding>)object toNetService:(NSNetService *)netService timeout:(NSTimeInterval)timeout responseBlock:(AsyncNetworkResponseBlock)block;
+
+// the response block of a cancelled request is not called and the connection becomes available to other requests
+- (void)cancelRequest:(id)request;
+
+- (void)closeIdleConnections;
+- (void)closeAllConnections;
+
+@end
@@ -0,0 +1,402 @@
+/**
+ * Copyright (C) 2011 Jonathan Diehl
+ * 
+ * Permission is hereby granted, free of charge, to any person obtaining a copy of
+ * this software and associated documentation files (the "Software"), to deal in
+ * the Software without restriction, including without limitation the rights to
+ * use, copy, modify, merge, publish, distribute, sublicense, and/or sell copies
+ * of the Software, and to permit persons to whom the Software is furnished to do
+ * so, subject to the following conditions:
+ * 
+ * The above copyright notice and this permission notice shall be included in all
+ * copies or substantial portions of the Software.
+ * 
+ * THE SOFTWARE IS PROVIDED "AS IS", WITHOUT WARRANTY OF ANY KIND, EXPRESS OR
+ * IMPLIED, INCLUDING BUT NOT LIMITED TO THE WARRANTIES OF MERCHANTABILITY,
+ * FITNESS FOR A PARTICULAR PURPOSE AND NONINFRINGEMENT. IN NO EVENT SHALL THE
+ * AUTHORS OR COPYRIGHT HOLDERS BE LIABLE FOR ANY CLAIM, DAMAGES OR OTHER
+ * LIABILITY, WHETHER IN AN ACTION OF CONTRACT, TORT OR OTHERWISE, ARISING FROM,
+ * OUT OF OR IN CONNECTION WITH THE SOFTWARE OR THE USE OR OTHER DEALINGS IN THE
+ * SOFTWARE.
+ * 
+ * https://github.com/jdiehl/async-network
+ */
+
+#import "AsyncConnectionPool.h"
+
+// a pooled connection and the requests waiting for it to connect
+@interface AsyncConnectionPoolEntry : NSObject
+@property (strong) AsyncConnection *connection;
+@property (strong) NSString *endpoint;
+@property (strong) NSMutableArray *waitingBlocks; // called once connected (with an error if the connection failed)
+@property (assign) NSUInteger requestCount;       // requests waiting or sent without a response yet
+@property (assign) CFAbsoluteTime lastUsed;
+@property (assign) NSUInteger idleGeneration;     // pending idle timeouts of an older generation are discarded
+@property (assign) BOOL started;
+@end
+
+@implementation AsyncConnectionPoolEntry
+@synthesize connection = _connection;
+@synthesize endpoint = _endpoint;
+@synthesize waitingBlocks = _waitingBlocks;
+@synthesize requestCount = _requestCount;
+@synthesize lastUsed = _lastUsed;
+@synthesize idleGeneration = _idleGeneration;
+@synthesize started = _started;
+@end
+
+// a request sent through the pool
+@interface AsyncConnectionPoolRequest : NSObject
+@property (weak) AsyncConnectionPoolEntry *entry;
+@property (assign) UInt32 tag;       // tag on the connection once sent
+@property (assign) BOOL finished;    // answered, failed or cancelled
+@end
+
+@implementation AsyncConnectionPoolRequest
+@synthesize entry = _entry;
+@synthesize tag = _tag;
+@synthesize finished = _finished;
+@end
+
+
+// private methods
+@interface AsyncConnectionPool () {
+	NSMutableDictionary *_endpoints; // endpoint -> entries
+}
+- (AsyncConnectionPoolRequest *)sendCommand:(AsyncCommand)command object:(id<NSCoding>)object timeout:(NSTimeInterval)timeout responseBlock:(AsyncNetworkResponseBlock)block endpoint:(NSString *)endpoint connectionBlock:(AsyncConnection *(^)(void))connectionBlock;
+- (AsyncConnectionPoolEntry *)entryForEndpoint:(NSString *)endpoint connectionBlock:(AsyncConnection *(^)(void))connectionBlock;
+- (AsyncConnectionPoolEntry *)entryForConnection:(AsyncConnection *)connection;
+- (void)requestDidFinishOnEntry:(AsyncConnectionPoolEntry *)entry;
+- (void)entryDidBecomeIdle:(AsyncConnectionPoolEntry *)entry;
+- (void)closeEntry:(AsyncConnectionPoolEntry *)entry error:(NSError *)error;
+@end
+
+
+@implementation AsyncConnectionPool
+
+@synthesize delegateQueue = _delegateQueue;
+@synthesize maxConnectionsPerEndpoint = _maxConnectionsPerEndpoint;
+@synthesize maxRequestsPerConnection = _maxRequestsPerConnection;
+@synthesize maxIdleConnections = _maxIdleConnections;
+@synthesize idleTimeout = _idleTimeout;
+
+// the pool used by AsyncRequest by default
++ (AsyncConnectionPool *)sharedPool;
+{
+	static AsyncConnectionPool *pool = nil;
+	static dispatch_once_t once;
+	dispatch_once(&once, ^{ pool = [self new]; });
+	return pool;
+}
+
+// init
+- (id)init;
+{
+	self = [super init];
+	if (self) {
+		self.maxConnectionsPerEndpoint = AsyncNetworkDefaultPoolMaxConnectionsPerEndpoint;
+		self.maxRequestsPerConnection = AsyncNetworkDefaultPoolMaxRequestsPerConnection;
+		self.maxIdleConnections = AsyncNetworkDefaultPoolMaxIdleConnections;
+		self.idleTimeout = AsyncNetworkDefaultPoolIdleTimeout;
+		_endpoints = [NSMutableDictionary new];
+	}
+	return self;
+}
+
+// clean up
+- (void)dealloc;
+{
+	for (NSArray *entries in [_endpoints allValues]) {
+		for (AsyncConnectionPoolEntry *entry in entries) {
+			entry.connection.delegate = nil;
+			[entry.connection cancel];
+		}
+	}
+}
+
+// debug description
+- (NSString *)description;
+{
+#ifdef __LP64__
+	return [NSString stringWithFormat:@"<%s endpoints=%ld>", object_getClassName(self), _endpoints.count];
+#else
+	return [NSString stringWithFormat:@"<%s endpoints=%d>", object_getClassName(self), _endpoints.count];
+#endif
+}
+
+
+#pragma mark - Custom Accessors
+
+// the delegate queue defaults to the global AsyncNetwork queue
+- (dispatch_queue_t)delegateQueue;
+{
+	return _delegateQueue ? _delegateQueue : AsyncNetworkDispatchQueue();
+}
+
+// set the delegate queue (before sending requests)
+- (void)setDelegateQueue:(dispatch_queue_t)delegateQueue;
+{
+	if (delegateQueue) AsyncNetworkRegisterQueue(delegateQueue);
+	_delegateQueue = delegateQueue;
+}
+
+// open and opening connections
+- (NSUInteger)connectionCount;
+{
+	__block NSUInteger count = 0;
+	AsyncNetworkPerformBlock(self.delegateQueue, YES, ^{
+		for (NSArray *entries in [_endpoints allValues]) count += entries.count;
+	});
+	return count;
+}
+
+
+#pragma mark - Control Methods
+
+// send a request to a host and port
+- (id)sendCommand:(AsyncCommand)command object:(id<NSCoding>)object toHost:(NSString *)host port:(NSUInteger)port timeout:(NSTimeInterval)timeout responseBlock:(AsyncNetworkResponseBlock)block;
+{
+	NSString *endpoint = [NSString stringWithFormat:@"%@:%lu", host, (unsigned long)port];
+	return [self sendCommand:command object:object timeout:timeout responseBlock:block endpoint:endpoint connectionBlock:^{
+		return [AsyncConnection connectionWithHost:host port:port];
+	}];
+}
+
+// send a request to a net service
+- (id)sendCommand:(AsyncCommand)command object:(id<NSCoding>)object toNetService:(NSNetService *)netService timeout:(NSTimeInterval)timeout responseBlock:(AsyncNetworkResponseBlock)block;
+{
+	NSString *endpoint = [NSString stringWithFormat:@"%@.%@%@", netService.name, netService.type, netService.domain];
+	return [self sendCommand:command object:object timeout:timeout responseBlock:block endpoint:endpoint connectionBlock:^{
+		return [AsyncConnection connectionWithNetService:netService];
+	}];
+}
+
+// cancel a request (the peer does not answer it if it supports cancelling)
+- (void)cancelRequest:(id)request;
+{
+	AsyncConnectionPoolRequest *poolRequest = request;
+	AsyncNetworkPerformBlock(self.delegateQueue, NO, ^{
+		if (poolRequest.finished) return;
+		poolRequest.finished = YES;
+		AsyncConnectionPoolEntry *entry = poolRequest.entry;
+		if (poolRequest.tag) [entry.connection cancelRequestWithTag:poolRequest.tag];
+		[self requestDidFinishOnEntry:entry];
+	});
+}
+
+// close all connections without pending requests
+- (void)closeIdleConnections;
+{
+	AsyncNetworkPerformBlock(self.delegateQueue, NO, ^{
+		for (NSArray *entries in [_endpoints allValues]) {
+			for (AsyncConnectionPoolEntry *entry in [entries copy]) {
+				if (entry.requestCount == 0) [self closeEntry:entry error:nil];
+			}
+		}
+	});
+}
+
+// close all connections (pending requests fail)
+- (void)closeAllConnections;
+{
+	AsyncNetworkPerformBlock(self.delegateQueue, NO, ^{
+		NSError *error = [NSError errorWithDomain:AsyncNetworkErrorDomain code:AsyncNetworkErrorDisconnected userInfo:nil];
+		for (NSArray *entries in [_endpoints allValues]) {
+			for (AsyncConnectionPoolEntry *entry in [entries copy]) {
+				[self closeEntry:entry error:error];
+			}
+		}
+	});
+}
+
+
+#pragma mark - Private Methods
+
+// send a request over a pooled connection to the endpoint (now if it is connected, otherwise once it is)
+- (AsyncConnectionPoolRequest *)sendCommand:(AsyncCommand)command object:(id<NSCoding>)object timeout:(NSTimeInterval)timeout responseBlock:(AsyncNetworkResponseBlock)block endpoint:(NSString *)endpoint connectionBlock:(AsyncConnection *(^)(void))connectionBlock;
+{
+	AsyncConnectionPoolRequest *request = [AsyncConnectionPoolRequest new];
+	AsyncNetworkPerformBlock(self.delegateQueue, NO, ^{
+		if (request.finished) return;
+		AsyncConnectionPoolEntry *entry = [self entryForEndpoint:endpoint connectionBlock:connectionBlock];
+		entry.requestCount++;
+		entry.idleGeneration++;
+		request.entry = entry;
+		
+		// cancelled requests are neither sent nor answered
+		__weak AsyncConnectionPool *weakSelf = self;
+		__weak AsyncConnectionPoolEntry *weakEntry = entry;
+		AsyncNetworkResponseBlock responseBlock = ^(id<NSCoding> response) {
+			if (request.finished) return;
+			request.finished = YES;
+			[weakSelf requestDidFinishOnEntry:weakEntry];
+			if (block) block(response);
+		};
+		CFAbsoluteTime deadline = CFAbsoluteTimeGetCurrent() + timeout;
+		void (^sendBlock)(NSError *) = ^(NSError *error) {
+			if (request.finished) return;
+			if (error) {
+				responseBlock(error);
+			} else {
+				NSTimeInterval remaining = timeout > 0 ? MAX(deadline - CFAbsoluteTimeGetCurrent(), 0.001) : timeout;
+				request.tag = [weakEntry.connection sendCommand:command object:object timeout:remaining responseBlock:responseBlock];
+			}
+		};
+		
+		if (entry.connection.connected) {
+			sendBlock(nil);
+			return;
+		}
+		
+		// the time spent connecting counts towards the timeout (the connection itself may never give up)
+		if (timeout > 0) {
+			dispatch_after(dispatch_time(DISPATCH_TIME_NOW, (int64_t)(timeout * NSEC_PER_SEC)), self.delegateQueue, ^{
+				if (request.tag == 0) responseBlock([NSError errorWithDomain:AsyncNetworkErrorDomain code:AsyncNetworkErrorRequestTimeout userInfo:nil]);
+			});
+		}
+		
+		// start connecting after queueing the request (starting may fail right away)
+		[entry.waitingBlocks addObject:[sendBlock copy]];
+		if (!entry.started) {
+			entry.started = YES;
+			[entry.connection start];
+		}
+	});
+	return request;
+}
+
+// the least loaded connection to the endpoint (a new one if all are busy and the endpoint has room)
+- (AsyncConnectionPoolEntry *)entryForEndpoint:(NSString *)endpoint connectionBlock:(AsyncConnection *(^)(void))connectionBlock;
+{
+	NSMutableArray *entries = [_endpoints objectForKey:endpoint];
+	AsyncConnectionPoolEntry *entry = nil;
+	for (AsyncConnectionPoolEntry *candidate in entries) {
+		if (!entry || candidate.requestCount < entry.requestCount) entry = candidate;
+	}
+	if (entry && (entry.requestCount < self.maxRequestsPerConnection || entries.count >= MAX(self.maxConnectionsPerEndpoint, 1))) return entry;
+	
+	// open a new connection
+	if (!entries) {
+		entries = [NSMutableArray new];
+		[_endpoints setObject:entries forKey:endpoint];
+	}
+	entry = [AsyncConnectionPoolEntry new];
+	entry.endpoint = endpoint;
+	entry.waitingBlocks = [NSMutableArray new];
+	entry.connection = connectionBlock();
+	entry.connection.delegate = self;
+	entry.connection.delegateQueue = self.delegateQueue;
+	[entries addObject:entry];
+	return entry;
+}
+
+// the entry of a pooled connection
+- (AsyncConnectionPoolEntry *)entryForConnection:(AsyncConnection *)connection;
+{
+	for (NSArray *entries in [_endpoints allValues]) {
+		for (AsyncConnectionPoolEntry *entry in entries) {
+			if (entry.connection == connection) return entry;
+		}
+	}
+	return nil;
+}
+
+// a request was answered or failed
+- (void)requestDidFinishOnEntry:(AsyncConnectionPoolEntry *)entry;
+{
+	if (!entry || entry.requestCount == 0) return;
+	entry.requestCount--;
+	entry.lastUsed = CFAbsoluteTimeGetCurrent();
+	if (entry.requestCount == 0 && entry.connection.connected) [self entryDidBecomeIdle:entry];
+}
+
+// keep an idle connection until the idle timeout (or until too many connections are idle)
+- (void)entryDidBecomeIdle:(AsyncConnectionPoolEntry *)entry;
+{
+	if (self.idleTimeout <= 0) {
+		[self closeEntry:entry error:nil];
+		return;
+	}
+	
+	// close the connection unless it was used again in the meantime
+	entry.idleGeneration++;
+	NSUInteger generation = entry.idleGeneration;
+	__weak AsyncConnectionPool *weakSelf = self;
+	__weak AsyncConnectionPoolEntry *weakEntry = entry;
+	dispatch_after(dispatch_time(DISPATCH_TIME_NOW, (int64_t)(self.idleTimeout * NSEC_PER_SEC)), self.delegateQueue, ^{
+		AsyncConnectionPoolEntry *idleEntry = weakEntry;
+		if (idleEntry && idleEntry.idleGeneration == generation && idleEntry.requestCount == 0) {
+			[weakSelf closeEntry:idleEntry error:nil];
+		}
+	});
+	
+	// close the least recently used idle connections above the limit
+	NSMutableArray *idleEntries = [NSMutableArray array];
+	for (NSArray *entries in [_endpoints allValues]) {
+		for (AsyncConnectionPoolEntry *candidate in entries) {
+			if (candidate.requestCount == 0) [idleEntries addObject:candidate];
+		}
+	}
+	while (idleEntries.count > self.maxIdleConnections) {
+		AsyncConnectionPoolEntry *oldest = nil;
+		for (AsyncConnectionPoolEntry *candidate in idleEntries) {
+			if (!oldest || candidate.lastUsed < oldest.lastUsed) oldest = candidate;
+		}
+		[idleEntries removeObject:oldest];
+		[self closeEntry:oldest error:nil];
+	}
+}
+
+// remove a connection from the pool and close it
+- (void)closeEntry:(AsyncConnectionPoolEntry *)entry error:(NSError *)error;
+{
+	NSMutableArray *entries = [_endpoints objectForKey:entry.endpoint];
+	if (![entries containsObject:entry]) return;
+	[entries removeObject:entry];
+	if (entries.count == 0) [_endpoints removeObjectForKey:entry.endpoint];
+	
+	// requests waiting for the connection fail
+	NSArray *waitingBlocks = [entry.waitingBlocks copy];
+	[entry.waitingBlocks removeAllObjects];
+	if (!error) error = [NSError errorWithDomain:AsyncNetworkErrorDomain code:AsyncNetworkErrorDisconnected userInfo:nil];
+	for (void (^waitingBlock)(NSError *) in waitingBlocks) {
+		waitingBlock(error);
+	}
+	
+	entry.connection.delegate = nil;
+	[entry.connection cancel];
+}
+
+
+#pragma mark - AsyncConnectionDelegate
+
+// send the requests that waited for the connection
+- (void)connectionDidConnect:(AsyncConnection *)theConnection;
+{
+	AsyncConnectionPoolEntry *entry = [self entryForConnection:theConnection];
+	NSArray *waitingBlocks = [entry.waitingBlocks copy];
+	[entry.waitingBlocks removeAllObjects];
+	for (void (^waitingBlock)(NSError *) in waitingBlocks) {
+		waitingBlock(nil);
+	}
+	
+	// all requests were cancelled or timed out while connecting
+	if (entry && entry.requestCount == 0) [self entryDidBecomeIdle:entry];
+}
+
+// the connection closed (pending requests were failed by the connection)
+- (void)connectionDidDisconnect:(AsyncConnection *)theConnection;
+{
+	AsyncConnectionPoolEntry *entry = [self entryForConnection:theConnection];
+	if (entry) [self closeEntry:entry error:nil];
+}
+
+// the connection could not be established
+- (void)connection:(AsyncConnection *)theConnection didFailWithError:(NSError *)error;
+{
+	AsyncConnectionPoolEntry *entry = [self entryForConnection:theConnection];
+	if (entry && !theConnection.connected) [self closeEntry:entry error:error];
+}
+
+
+@end
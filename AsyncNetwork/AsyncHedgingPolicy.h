@@ -0,0 +1,64 @@
+/**
+ * Copyright (C) 2011 Jonathan Diehl
+ * 
+ * Permission is hereby granted, free of charge, to any person obtaining a copy of
+ * this software and associated documentation files (the "Software"), to deal in
+ * the Software without restriction, including without limitation the rights to
+ * use, copy, modify, merge, publish, distribute, sublicense, and/or sell copies
+ * of the Software, and to permit persons to whom the Software is furnished to do
+ * so, subject to the following conditions:
+ * 
+ * The above copyright notice and this permission notice shall be included in all
+ * copies or substantial portions of the Software.
+ * 
+ * THE SOFTWARE IS PROVIDED "AS IS", WITHOUT WARRANTY OF ANY KIND, EXPRESS OR
+ * IMPLIED, INCLUDING BUT NOT LIMITED TO THE WARRANTIES OF MERCHANTABILITY,
+ * FITNESS FOR A PARTICULAR PURPOSE AND NONINFRINGEMENT. IN NO EVENT SHALL THE
+ * AUTHORS OR COPYRIGHT HOLDERS BE LIABLE FOR ANY CLAIM, DAMAGES OR OTHER
+ * LIABILITY, WHETHER IN AN ACTION OF CONTRACT, TORT OR OTHERWISE, ARISING FROM,
+ * OUT OF OR IN CONNECTION WITH THE SOFTWARE OR THE USE OR OTHER DEALINGS IN THE
+ * SOFTWARE.
+ * 
+ * https://github.com/jdiehl/async-network
+ */
+
+#import <Foundation/Foundation.h>
+#import "AsyncConnection.h"
+
+/// sends one attempt of a hedged request and returns a block that cancels it
+typedef dispatch_block_t (^AsyncHedgingAttemptBlock)(NSUInteger attempt, AsyncNetworkResponseBlock responseBlock);
+
+/**
+ @brief A hedging policy sends a request again if it is not answered quickly and keeps the first response
+ @details A request that is not answered within the hedging delay is sent to the next endpoint (an attempt
+ that fails is followed by the next one right away without using the budget). The first response wins and
+ the other attempts are cancelled, an error is only reported once all sent attempts failed. The delay is the given percentile of the
+ latencies observed for the command (or the fixed delay until minimumSamples latencies were observed).
+ Every request adds budget to the hedges that may be sent, at most burst of them are saved up, so hedging
+ adds no more than budget times the requests to the load. A policy can be shared by many requests.
+ */
+@interface AsyncHedgingPolicy : NSObject
+
+@property (assign) NSTimeInterval delay;       // fixed hedging delay
+@property (assign) double percentile;          // percentile (0-100) of the observed latencies used as delay (0: always use the fixed delay)
+@property (assign) NSUInteger minimumSamples;  // latencies observed before the percentile is used
+@property (assign) double budget;              // hedges allowed per request (e.g. 0.1 adds at most 10% load)
+@property (assign) NSUInteger burst;           // hedges that may be saved up
+@property (readonly) NSUInteger requestCount;  // requests performed
+@property (readonly) NSUInteger hedgeCount;    // attempts sent after the hedging delay (not failovers)
+@property (readonly) NSUInteger cancelledCount; // attempts cancelled before they completed (not part of the latencies)
+
++ (id)policyWithDelay:(NSTimeInterval)delay;
+
+// the hedging delay for a command
+- (NSTimeInterval)delayForCommand:(AsyncCommand)command;
+- (void)recordLatency:(NSTimeInterval)latency forCommand:(AsyncCommand)command;
+
+// take a hedge from the budget
+- (BOOL)acquireHedge;
+
+// perform a request with up to the given number of attempts (the response block is called once on the queue of the winning attempt)
+// returns a block that cancels all attempts without calling the response block
+- (dispatch_block_t)performRequestWithCommand:(AsyncCommand)command attempts:(NSUInteger)attempts attemptBlock:(AsyncHedgingAttemptBlock)attemptBlock responseBlock:(AsyncNetworkResponseBlock)block;
+
+@end
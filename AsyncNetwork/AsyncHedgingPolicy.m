@@ -0,0 +1,288 @@
+/**
+ * Copyright (C) 2011 Jonathan Diehl
+ * 
+ * Permission is hereby granted, free of charge, to any person obtaining a copy of
+ * this software and associated documentation files (the "Software"), to deal in
+ * the Software without restriction, including without limitation the rights to
+ * use, copy, modify, merge, publish, distribute, sublicense, and/or sell copies
+ * of the Software, and to permit persons to whom the Software is furnished to do
+ * so, subject to the following conditions:
+ * 
+ * The above copyright notice and this permission notice shall be included in all
+ * copies or substantial portions of the Software.
+ * 
+ * THE SOFTWARE IS PROVIDED "AS IS", WITHOUT WARRANTY OF ANY KIND, EXPRESS OR
+ * IMPLIED, INCLUDING BUT NOT LIMITED TO THE WARRANTIES OF MERCHANTABILITY,
+ * FITNESS FOR A PARTICULAR PURPOSE AND NONINFRINGEMENT. IN NO EVENT SHALL THE
+ * AUTHORS OR COPYRIGHT HOLDERS BE LIABLE FOR ANY CLAIM, DAMAGES OR OTHER
+ * LIABILITY, WHETHER IN AN ACTION OF CONTRACT, TORT OR OTHERWISE, ARISING FROM,
+ * OUT OF OR IN CONNECTION WITH THE SOFTWARE OR THE USE OR OTHER DEALINGS IN THE
+ * SOFTWARE.
+ * 
+ * https://github.com/jdiehl/async-network
+ */
+
+#import "AsyncHedgingPolicy.h"
+#import "AsyncLatencyHistogram.h"
+
+// the attempts of a hedged request
+@interface AsyncHedgedRequest : NSObject
+@property (assign) AsyncCommand command;
+@property (assign) NSUInteger attempts;           // attempts that may be sent
+@property (copy) AsyncHedgingAttemptBlock attemptBlock;
+@property (copy) AsyncNetworkResponseBlock responseBlock;
+@property (strong) NSMutableArray *cancelBlocks;  // by attempt ([NSNull null] once answered or failed)
+@property (strong) NSMutableArray *sendTimes;     // by attempt
+@property (assign) NSUInteger outstanding;        // attempts sent without a response yet
+@property (strong) NSError *error;                // error of the last failed attempt
+@property (assign) BOOL finished;
+@end
+
+@implementation AsyncHedgedRequest
+@synthesize command = _command;
+@synthesize attempts = _attempts;
+@synthesize attemptBlock = _attemptBlock;
+@synthesize responseBlock = _responseBlock;
+@synthesize cancelBlocks = _cancelBlocks;
+@synthesize sendTimes = _sendTimes;
+@synthesize outstanding = _outstanding;
+@synthesize error = _error;
+@synthesize finished = _finished;
+@end
+
+
+// private methods
+@interface AsyncHedgingPolicy () {
+	NSMutableDictionary *_latencyHistograms; // command -> AsyncLatencyHistogram
+	double _tokens;                          // hedges saved up
+}
+- (void)sendNextAttemptOfRequest:(AsyncHedgedRequest *)request;
+- (void)scheduleHedgeOfRequest:(AsyncHedgedRequest *)request;
+- (void)request:(AsyncHedgedRequest *)request attempt:(NSUInteger)attempt didReceiveResponse:(id)response;
+- (void)cancelRequest:(AsyncHedgedRequest *)request;
+@end
+
+
+@implementation AsyncHedgingPolicy
+
+@synthesize delay = _delay;
+@synthesize percentile = _percentile;
+@synthesize minimumSamples = _minimumSamples;
+@synthesize budget = _budget;
+@synthesize burst = _burst;
+@synthesize requestCount = _requestCount;
+@synthesize hedgeCount = _hedgeCount;
+@synthesize cancelledCount = _cancelledCount;
+
+// create a policy with a fixed delay
++ (id)policyWithDelay:(NSTimeInterval)delay;
+{
+	AsyncHedgingPolicy *policy = [self new];
+	policy.delay = delay;
+	policy.percentile = 0;
+	return policy;
+}
+
+// init
+- (id)init;
+{
+	self = [super init];
+	if (self) {
+		self.delay = AsyncNetworkDefaultHedgingDelay;
+		self.percentile = AsyncNetworkDefaultHedgingPercentile;
+		self.minimumSamples = AsyncNetworkDefaultHedgingMinimumSamples;
+		self.budget = AsyncNetworkDefaultHedgingBudget;
+		self.burst = AsyncNetworkDefaultHedgingBurst;
+		_latencyHistograms = [NSMutableDictionary new];
+		_tokens = self.burst;
+	}
+	return self;
+}
+
+// debug description
+- (NSString *)description;
+{
+#ifdef __LP64__
+	return [NSString stringWithFormat:@"<%s requests=%ld hedges=%ld cancelled=%ld>", object_getClassName(self), self.requestCount, self.hedgeCount, self.cancelledCount];
+#else
+	return [NSString stringWithFormat:@"<%s requests=%d hedges=%d cancelled=%d>", object_getClassName(self), self.requestCount, self.hedgeCount, self.cancelledCount];
+#endif
+}
+
+
+#pragma mark - Control Methods
+
+// the percentile of the observed latencies (or the fixed delay)
+- (NSTimeInterval)delayForCommand:(AsyncCommand)command;
+{
+	@synchronized(self) {
+		AsyncLatencyHistogram *histogram = [_latencyHistograms objectForKey:[NSNumber numberWithUnsignedInt:command]];
+		if (self.percentile > 0 && histogram.count >= MAX(self.minimumSamples, 1)) {
+			return [histogram latencyAtPercentile:self.percentile];
+		}
+		return self.delay;
+	}
+}
+
+// observe the latency of an answered attempt
+- (void)recordLatency:(NSTimeInterval)latency forCommand:(AsyncCommand)command;
+{
+	@synchronized(self) {
+		NSNumber *key = [NSNumber numberWithUnsignedInt:command];
+		AsyncLatencyHistogram *histogram = [_latencyHistograms objectForKey:key];
+		if (!histogram) {
+			histogram = [AsyncLatencyHistogram new];
+			[_latencyHistograms setObject:histogram forKey:key];
+		}
+		[histogram recordLatency:latency];
+	}
+}
+
+// take a hedge from the budget
+- (BOOL)acquireHedge;
+{
+	@synchronized(self) {
+		if (_tokens < 1.0) return NO;
+		_tokens -= 1.0;
+		_hedgeCount++;
+		return YES;
+	}
+}
+
+// perform a hedged request
+- (dispatch_block_t)performRequestWithCommand:(AsyncCommand)command attempts:(NSUInteger)attempts attemptBlock:(AsyncHedgingAttemptBlock)attemptBlock responseBlock:(AsyncNetworkResponseBlock)block;
+{
+	@synchronized(self) {
+		_requestCount++;
+		_tokens = MIN(_tokens + self.budget, (double)self.burst);
+	}
+	
+	AsyncHedgedRequest *request = [AsyncHedgedRequest new];
+	request.command = command;
+	request.attempts = MAX(attempts, 1);
+	request.attemptBlock = attemptBlock;
+	request.responseBlock = block;
+	request.cancelBlocks = [NSMutableArray arrayWithCapacity:request.attempts];
+	request.sendTimes = [NSMutableArray arrayWithCapacity:request.attempts];
+	[self sendNextAttemptOfRequest:request];
+	[self scheduleHedgeOfRequest:request];
+	return ^{ [self cancelRequest:request]; };
+}
+
+
+#pragma mark - Private Methods
+
+// send the next attempt
+- (void)sendNextAttemptOfRequest:(AsyncHedgedRequest *)request;
+{
+	NSUInteger attempt;
+	@synchronized(request) {
+		if (request.finished || request.cancelBlocks.count >= request.attempts) return;
+		attempt = request.cancelBlocks.count;
+		[request.cancelBlocks addObject:[NSNull null]];
+		[request.sendTimes addObject:[NSNumber numberWithDouble:CFAbsoluteTimeGetCurrent()]];
+		request.outstanding++;
+	}
+	
+	// the attempt may be answered before it returns its cancel block
+	dispatch_block_t cancelBlock = request.attemptBlock(attempt, ^(id<NSCoding> response) {
+		[self request:request attempt:attempt didReceiveResponse:response];
+	});
+	if (!cancelBlock) return;
+	BOOL cancel = NO;
+	@synchronized(request) {
+		if ([request.sendTimes objectAtIndex:attempt] == (id)[NSNull null]) return;
+		if (request.finished) {
+			cancel = YES;
+		} else {
+			[request.cancelBlocks replaceObjectAtIndex:attempt withObject:[cancelBlock copy]];
+		}
+	}
+	if (cancel) cancelBlock();
+}
+
+// send the next attempt after the hedging delay (if the budget allows it)
+- (void)scheduleHedgeOfRequest:(AsyncHedgedRequest *)request;
+{
+	@synchronized(request) {
+		if (request.cancelBlocks.count >= request.attempts) return;
+	}
+	NSTimeInterval delay = [self delayForCommand:request.command];
+	dispatch_after(dispatch_time(DISPATCH_TIME_NOW, (int64_t)(delay * NSEC_PER_SEC)), dispatch_get_global_queue(DISPATCH_QUEUE_PRIORITY_DEFAULT, 0), ^{
+		@synchronized(request) {
+			if (request.finished || request.cancelBlocks.count >= request.attempts) return;
+		}
+		if (![self acquireHedge]) return;
+		[self sendNextAttemptOfRequest:request];
+		[self scheduleHedgeOfRequest:request];
+	});
+}
+
+// the first response wins, an error only once no attempt is left
+- (void)request:(AsyncHedgedRequest *)request attempt:(NSUInteger)attempt didReceiveResponse:(id)response;
+{
+	CFAbsoluteTime now = CFAbsoluteTimeGetCurrent();
+	NSMutableArray *cancelBlocks = [NSMutableArray array];
+	BOOL retry = NO;
+	@synchronized(request) {
+		if (request.finished || [request.sendTimes objectAtIndex:attempt] == (id)[NSNull null]) return;
+		NSTimeInterval latency = now - [[request.sendTimes objectAtIndex:attempt] doubleValue];
+		[request.sendTimes replaceObjectAtIndex:attempt withObject:[NSNull null]];
+		[request.cancelBlocks replaceObjectAtIndex:attempt withObject:[NSNull null]];
+		request.outstanding--;
+		
+		if ([response isKindOfClass:[NSError class]]) {
+			// a failed attempt is followed by the next one right away
+			request.error = response;
+			retry = request.cancelBlocks.count < request.attempts;
+			if (!retry && request.outstanding > 0) return;
+		} else {
+			[self recordLatency:latency forCommand:request.command];
+		}
+		
+		if (!retry) {
+			// the other attempts lose (they never completed, so they have no latency to record)
+			request.finished = YES;
+			for (id cancelBlock in request.cancelBlocks) {
+				if (cancelBlock != [NSNull null]) [cancelBlocks addObject:cancelBlock];
+			}
+			@synchronized(self) {
+				_cancelledCount += request.outstanding;
+			}
+		}
+	}
+	
+	// failing over is not a hedge, the next attempt is hedged again after the delay
+	if (retry) {
+		[self sendNextAttemptOfRequest:request];
+		[self scheduleHedgeOfRequest:request];
+		return;
+	}
+	
+	for (dispatch_block_t cancelBlock in cancelBlocks) {
+		cancelBlock();
+	}
+	if (request.responseBlock) request.responseBlock(response);
+}
+
+// finish without a response and cancel the outstanding attempts
+- (void)cancelRequest:(AsyncHedgedRequest *)request;
+{
+	NSMutableArray *cancelBlocks = [NSMutableArray array];
+	@synchronized(request) {
+		if (request.finished) return;
+		request.finished = YES;
+		for (id cancelBlock in request.cancelBlocks) {
+			if (cancelBlock != [NSNull null]) [cancelBlocks addObject:cancelBlock];
+		}
+		@synchronized(self) {
+			_cancelledCount += request.outstanding;
+		}
+	}
+	for (dispatch_block_t cancelBlock in cancelBlocks) {
+		cancelBlock();
+	}
+}
+
+
+@end
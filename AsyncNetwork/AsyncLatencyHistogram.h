@@ -0,0 +1,54 @@
+/**
+ * Copyright (C) 2011 Jonathan Diehl
+ * 
+ * Permission is hereby granted, free of charge, to any person obtaining a copy of
+ * this software and associated documentation files (the "Software"), to deal in
+ * the Software without restriction, including without limitation the rights to
+ * use, copy, modify, merge, publish, distribute, sublicense, and/or sell copies
+ * of the Software, and to permit persons to whom the Software is furnished to do
+ * so, subject to the following conditions:
+ * 
+ * The above copyright notice and this permission notice shall be included in all
+ * copies or substantial portions of the Software.
+ * 
+ * THE SOFTWARE IS PROVIDED "AS IS", WITHOUT WARRANTY OF ANY KIND, EXPRESS OR
+ * IMPLIED, INCLUDING BUT NOT LIMITED TO THE WARRANTIES OF MERCHANTABILITY,
+ * FITNESS FOR A PARTICULAR PURPOSE AND NONINFRINGEMENT. IN NO EVENT SHALL THE
+ * AUTHORS OR COPYRIGHT HOLDERS BE LIABLE FOR ANY CLAIM, DAMAGES OR OTHER
+ * LIABILITY, WHETHER IN AN ACTION OF CONTRACT, TORT OR OTHERWISE, ARISING FROM,
+ * OUT OF OR IN CONNECTION WITH THE SOFTWARE OR THE USE OR OTHER DEALINGS IN THE
+ * SOFTWARE.
+ * 
+ * https://github.com/jdiehl/async-network
+ */
+
+#import <Foundation/Foundation.h>
+
+/**
+ @brief Histogram of latencies with logarithmic buckets
+ @details Latencies are counted in microseconds in buckets that are 1/8 of a power of two wide,
+ so percentiles are accurate to about 6% and a histogram always takes the same few kilobytes
+ no matter how many latencies it records (up to 12 days, longer latencies end up in the last bucket).
+ */
+@interface AsyncLatencyHistogram : NSObject <NSCopying>
+
+@property (readonly) UInt64 count;            // number of recorded latencies
+@property (readonly) NSTimeInterval minimum;  // smallest recorded latency
+@property (readonly) NSTimeInterval maximum;  // largest recorded latency
+@property (readonly) NSTimeInterval mean;     // average of the recorded latencies
+@property (readonly) NSTimeInterval p50;
+@property (readonly) NSTimeInterval p90;
+@property (readonly) NSTimeInterval p99;
+@property (readonly) NSTimeInterval p999;
+
+// add histograms by key (e.g. by command) to a total
++ (void)addHistograms:(NSDictionary *)histograms toHistograms:(NSMutableDictionary *)total;
+
+- (void)recordLatency:(NSTimeInterval)latency;
+- (void)addHistogram:(AsyncLatencyHistogram *)histogram;
+- (void)reset;
+
+// the latency below which the given percentage (0-100) of the recorded latencies lie
+- (NSTimeInterval)latencyAtPercentile:(double)percentile;
+
+@end
@@ -0,0 +1,200 @@
+/**
+ * Copyright (C) 2011 Jonathan Diehl
+ * 
+ * Permission is hereby granted, free of charge, to any person obtaining a copy of
+ * this software and associated documentation files (the "Software"), to deal in
+ * the Software without restriction, including without limitation the rights to
+ * use, copy, modify, merge, publish, distribute, sublicense, and/or sell copies
+ * of the Software, and to permit persons to whom the Software is furnished to do
+ * so, subject to the following conditions:
+ * 
+ * The above copyright notice and this permission notice shall be included in all
+ * copies or substantial portions of the Software.
+ * 
+ * THE SOFTWARE IS PROVIDED "AS IS", WITHOUT WARRANTY OF ANY KIND, EXPRESS OR
+ * IMPLIED, INCLUDING BUT NOT LIMITED TO THE WARRANTIES OF MERCHANTABILITY,
+ * FITNESS FOR A PARTICULAR PURPOSE AND NONINFRINGEMENT. IN NO EVENT SHALL THE
+ * AUTHORS OR COPYRIGHT HOLDERS BE LIABLE FOR ANY CLAIM, DAMAGES OR OTHER
+ * LIABILITY, WHETHER IN AN ACTION OF CONTRACT, TORT OR OTHERWISE, ARISING FROM,
+ * OUT OF OR IN CONNECTION WITH THE SOFTWARE OR THE USE OR OTHER DEALINGS IN THE
+ * SOFTWARE.
+ * 
+ * https://github.com/jdiehl/async-network
+ */
+
+#import "AsyncLatencyHistogram.h"
+
+#define AsyncLatencyHistogramSubBuckets 8    // buckets per power of two
+#define AsyncLatencyHistogramMaxPower 39     // 2^40 µs are about 12 days
+#define AsyncLatencyHistogramBuckets ((AsyncLatencyHistogramMaxPower - 2) * AsyncLatencyHistogramSubBuckets + AsyncLatencyHistogramSubBuckets)
+
+// private functions
+NSUInteger BucketForMicroseconds(UInt64 microseconds);
+UInt64 MicrosecondsForBucket(NSUInteger bucket);
+
+@interface AsyncLatencyHistogram () {
+	UInt64 _buckets[AsyncLatencyHistogramBuckets];
+	UInt64 _count;
+	UInt64 _totalMicroseconds;
+	UInt64 _minimumMicroseconds;
+	UInt64 _maximumMicroseconds;
+}
+@end
+
+@implementation AsyncLatencyHistogram
+
+// add histograms by key to a total
++ (void)addHistograms:(NSDictionary *)histograms toHistograms:(NSMutableDictionary *)total;
+{
+	for (id key in histograms) {
+		AsyncLatencyHistogram *histogram = [total objectForKey:key];
+		if (!histogram) {
+			histogram = [AsyncLatencyHistogram new];
+			[total setObject:histogram forKey:key];
+		}
+		[histogram addHistogram:[histograms objectForKey:key]];
+	}
+}
+
+// init
+- (id)init;
+{
+	self = [super init];
+	if (self) {
+		[self reset];
+	}
+	return self;
+}
+
+// copy
+- (id)copyWithZone:(NSZone *)zone;
+{
+	AsyncLatencyHistogram *copy = [[[self class] allocWithZone:zone] init];
+	[copy addHistogram:self];
+	return copy;
+}
+
+// debug description
+- (NSString *)description;
+{
+	return [NSString stringWithFormat:@"<%s count=%llu p50=%.6f p90=%.6f p99=%.6f p999=%.6f max=%.6f>", object_getClassName(self), self.count, self.p50, self.p90, self.p99, self.p999, self.maximum];
+}
+
+// record a latency
+- (void)recordLatency:(NSTimeInterval)latency;
+{
+	UInt64 microseconds = latency > 0 ? (UInt64)(latency * 1000000.0) : 0;
+	_buckets[BucketForMicroseconds(microseconds)]++;
+	_count++;
+	_totalMicroseconds += microseconds;
+	if (microseconds < _minimumMicroseconds) _minimumMicroseconds = microseconds;
+	if (microseconds > _maximumMicroseconds) _maximumMicroseconds = microseconds;
+}
+
+// add all latencies recorded by another histogram
+- (void)addHistogram:(AsyncLatencyHistogram *)histogram;
+{
+	if (histogram->_count == 0) return;
+	for (NSUInteger i = 0; i < AsyncLatencyHistogramBuckets; i++) _buckets[i] += histogram->_buckets[i];
+	_count += histogram->_count;
+	_totalMicroseconds += histogram->_totalMicroseconds;
+	if (histogram->_minimumMicroseconds < _minimumMicroseconds) _minimumMicroseconds = histogram->_minimumMicroseconds;
+	if (histogram->_maximumMicroseconds > _maximumMicroseconds) _maximumMicroseconds = histogram->_maximumMicroseconds;
+}
+
+// forget all recorded latencies
+- (void)reset;
+{
+	memset(_buckets, 0, sizeof(_buckets));
+	_count = 0;
+	_totalMicroseconds = 0;
+	_minimumMicroseconds = UINT64_MAX;
+	_maximumMicroseconds = 0;
+}
+
+// the latency below which the given percentage of the recorded latencies lie
+- (NSTimeInterval)latencyAtPercentile:(double)percentile;
+{
+	if (_count == 0) return 0;
+	UInt64 rank = (UInt64)ceil(_count * MIN(MAX(percentile, 0.0), 100.0) / 100.0);
+	if (rank == 0) rank = 1;
+	
+	UInt64 seen = 0;
+	for (NSUInteger i = 0; i < AsyncLatencyHistogramBuckets; i++) {
+		seen += _buckets[i];
+		if (seen >= rank) {
+			// the bucket midpoint, but never beyond the recorded extremes
+			UInt64 microseconds = MIN(MAX(MicrosecondsForBucket(i), _minimumMicroseconds), _maximumMicroseconds);
+			return microseconds / 1000000.0;
+		}
+	}
+	return self.maximum;
+}
+
+// number of recorded latencies
+- (UInt64)count;
+{
+	return _count;
+}
+
+// smallest recorded latency
+- (NSTimeInterval)minimum;
+{
+	return _count > 0 ? _minimumMicroseconds / 1000000.0 : 0;
+}
+
+// largest recorded latency
+- (NSTimeInterval)maximum;
+{
+	return _maximumMicroseconds / 1000000.0;
+}
+
+// average latency
+- (NSTimeInterval)mean;
+{
+	return _count > 0 ? (double)_totalMicroseconds / _count / 1000000.0 : 0;
+}
+
+// percentiles
+- (NSTimeInterval)p50;
+{
+	return [self latencyAtPercentile:50.0];
+}
+
+- (NSTimeInterval)p90;
+{
+	return [self latencyAtPercentile:90.0];
+}
+
+- (NSTimeInterval)p99;
+{
+	return [self latencyAtPercentile:99.0];
+}
+
+- (NSTimeInterval)p999;
+{
+	return [self latencyAtPercentile:99.9];
+}
+
+@end
+
+// bucket of a latency
+// values below 8 µs have a bucket each, above that every power of two is split into 8 buckets
+NSUInteger BucketForMicroseconds(UInt64 microseconds)
+{
+	if (microseconds < AsyncLatencyHistogramSubBuckets) return (NSUInteger)microseconds;
+	NSUInteger power = 63 - __builtin_clzll(microseconds);
+	if (power > AsyncLatencyHistogramMaxPower) return AsyncLatencyHistogramBuckets - 1;
+	NSUInteger subBucket = (NSUInteger)(microseconds >> (power - 3)) & (AsyncLatencyHistogramSubBuckets - 1);
+	return (power - 2) * AsyncLatencyHistogramSubBuckets + subBucket;
+}
+
+// midpoint of a bucket
+UInt64 MicrosecondsForBucket(NSUInteger bucket)
+{
+	if (bucket < AsyncLatencyHistogramSubBuckets) return bucket;
+	NSUInteger power = bucket / AsyncLatencyHistogramSubBuckets + 2;
+	NSUInteger subBucket = bucket % AsyncLatencyHistogramSubBuckets;
+	UInt64 width = 1ULL << (power - 3);
+	return (AsyncLatencyHistogramSubBuckets + subBucket) * width + width / 2;
+}
@@ -23,8 +23,15 @@
  */
 
 #import "AsyncNetworkHelpers.h"
+#import "AsyncCodec.h"
+#import "AsyncLatencyHistogram.h"
+#import "AsyncTrace.h"
+#import "AsyncAddressCache.h"
 #import "AsyncConnection.h"
+#import "AsyncConnectionPool.h"
+#import "AsyncHedgingPolicy.h"
 #import "AsyncRequest.h"
+#import "AsyncRequestGroup.h"
 #import "AsyncClient.h"
 #import "AsyncServer.h"
 #import "AsyncBroadcaster.h"
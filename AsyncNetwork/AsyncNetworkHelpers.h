@@ -47,6 +47,9 @@ extern const NSTimeInterval AsyncNetworkDefaultConnectionTimeout;
 /// Default net service resolve timeout for the AsyncConnection
 extern const NSTimeInterval AsyncNetworkDefaultResolveTimeout;
 
+/// Default delay after which the AsyncConnection also connects to the other address family
+extern const NSTimeInterval AsyncNetworkDefaultAlternateAddressDelay;
+
 /// Default broadcasting address for the AsyncBroadcaster
 extern NSString *AsyncNetworkBroadcastDefaultSubnet;
 
@@ -56,6 +59,84 @@ extern const NSTimeInterval AsyncNetworkBroadcastDefaultTimeout;
 /// Default timeout for the AsyncRequest
 extern const NSTimeInterval AsyncRequestDefaultTimeout;
 
+/// Default response timeout for requests sent by the AsyncConnection
+extern const NSTimeInterval AsyncNetworkDefaultRequestTimeout;
+
+/// Default maximum size of a body received by the AsyncConnection (after reassembly and decompression)
+extern const NSUInteger AsyncNetworkDefaultMaxBodySize;
+
+/// Default body size from which the AsyncConnection compresses bodies (if enabled)
+extern const NSUInteger AsyncNetworkDefaultCompressionThreshold;
+
+/// Default batch size at which the AsyncConnection flushes batched frames (if enabled)
+extern const NSUInteger AsyncNetworkDefaultBatchMaxBytes;
+
+/// Default chunk size for streams sent by the AsyncConnection
+extern const NSUInteger AsyncNetworkDefaultStreamChunkSize;
+
+/// Default number of bytes the AsyncConnection queues for writing while streaming
+extern const NSUInteger AsyncNetworkDefaultStreamWindowSize;
+
+/// Default write queue size at which the AsyncConnection applies its write policy
+extern const NSUInteger AsyncNetworkDefaultWriteHighWatermark;
+
+/// Default write queue size below which the AsyncConnection reports that the queue drained
+extern const NSUInteger AsyncNetworkDefaultWriteLowWatermark;
+
+/// Default maximum body size of a fragment sent by the AsyncConnection
+extern const NSUInteger AsyncNetworkDefaultFragmentSize;
+
+/// Default number of bytes the AsyncConnection hands to the socket at once
+extern const NSUInteger AsyncNetworkDefaultWriteWindowSize;
+
+/// Default number of unanswered heartbeats after which the AsyncConnection disconnects
+extern const NSUInteger AsyncNetworkDefaultMaxMissedHeartbeats;
+
+/// Default time after which the AsyncConnectionPool closes an idle connection
+extern const NSTimeInterval AsyncNetworkDefaultPoolIdleTimeout;
+
+/// Default number of idle connections kept open by the AsyncConnectionPool
+extern const NSUInteger AsyncNetworkDefaultPoolMaxIdleConnections;
+
+/// Default number of connections the AsyncConnectionPool opens to the same endpoint
+extern const NSUInteger AsyncNetworkDefaultPoolMaxConnectionsPerEndpoint;
+
+/// Default number of pending requests on a pooled connection before the AsyncConnectionPool opens another one
+extern const NSUInteger AsyncNetworkDefaultPoolMaxRequestsPerConnection;
+
+/// Default time after which an AsyncHedgingPolicy sends a request again (until enough latencies were observed)
+extern const NSTimeInterval AsyncNetworkDefaultHedgingDelay;
+
+/// Default percentile (0-100) of the observed latencies after which an AsyncHedgingPolicy sends a request again
+extern const double AsyncNetworkDefaultHedgingPercentile;
+
+/// Default number of observed latencies an AsyncHedgingPolicy requires before it uses the percentile
+extern const NSUInteger AsyncNetworkDefaultHedgingMinimumSamples;
+
+/// Default ratio of hedged to sent requests allowed by an AsyncHedgingPolicy
+extern const double AsyncNetworkDefaultHedgingBudget;
+
+/// Default number of hedges an AsyncHedgingPolicy may send in a row when its budget was saved up
+extern const NSUInteger AsyncNetworkDefaultHedgingBurst;
+
+/// Default time the AsyncAddressCache keeps resolved addresses
+extern const NSTimeInterval AsyncNetworkDefaultAddressCacheTimeToLive;
+
+/// Default part (0-1) of the time to live after which the AsyncAddressCache refreshes used addresses in the background
+extern const double AsyncNetworkDefaultAddressCacheRefreshThreshold;
+
+/// Error domain for errors reported by AsyncNetwork
+extern NSString *AsyncNetworkErrorDomain;
+
+/// Error codes in the AsyncNetworkErrorDomain
+enum {
+	AsyncNetworkErrorRequestTimeout = 1, // no response arrived before the request timeout
+	AsyncNetworkErrorDisconnected = 2,   // the connection closed before a response arrived
+	AsyncNetworkErrorNotSupported = 3,   // the peer does not support the requested feature
+	AsyncNetworkErrorWriteQueueFull = 4, // the frame was dropped because the write queue is full
+	AsyncNetworkErrorHeartbeatTimeout = 5 // the peer stopped answering heartbeats
+};
+
 
 #pragma mark - Public Functions
 
@@ -65,8 +146,23 @@ extern dispatch_queue_t AsyncNetworkDispatchQueue();
 /// Set the Dispatch Queue used by AsyncNetwork
 extern void SetAsyncNetworkDispatchQueue(dispatch_queue_t queue);
 
+/// Mark a serial queue so that AsyncNetworkPerformBlock can detect that it is running on it
+extern void AsyncNetworkRegisterQueue(dispatch_queue_t queue);
+
+/// Run a block on a registered queue (directly if already running on it, otherwise asynchronously or waiting)
+extern void AsyncNetworkPerformBlock(dispatch_queue_t queue, BOOL wait, dispatch_block_t block);
+
+/// Create a registered serial queue for a connection that targets the given queue (NULL: default global queue)
+extern dispatch_queue_t AsyncNetworkCreateConnectionQueue(dispatch_queue_t targetQueue);
+
 /// Return the IP addresses of all local interfaces.
 extern NSArray *AsyncNetworkGetLocalIPAddresses(void);
 
 /// Test if a given IP address string is local
 extern BOOL AsyncNetworkIPAddressIsLocal(NSString *address);
+
+/// Append an unsigned integer as a little endian base 128 varint
+extern void AsyncNetworkAppendVarint(NSMutableData *data, UInt64 value);
+
+/// Read a varint at the given offset and advance the offset, returns NO if the bytes end before the varint
+extern BOOL AsyncNetworkReadVarint(const UInt8 *bytes, NSUInteger length, NSUInteger *offset, UInt64 *value);
@@ -43,6 +43,9 @@ const NSTimeInterval AsyncNetworkDefaultConnectionTimeout = -1.0;
 /// Default net service resolve timeout for the AsyncConnection
 const NSTimeInterval AsyncNetworkDefaultResolveTimeout = -1.0;
 
+/// Default delay after which the AsyncConnection also connects to the other address family
+const NSTimeInterval AsyncNetworkDefaultAlternateAddressDelay = 0.3;
+
 // Default broadcasting address for the AsyncBroadcaster
 NSString *AsyncNetworkBroadcastDefaultSubnet = @"255.255.255.255";
 
@@ -52,6 +55,75 @@ const NSTimeInterval AsyncNetworkBroadcastDefaultTimeout = -1.0;
 /// Default timeout for the AsyncRequest
 const NSTimeInterval AsyncRequestDefaultTimeout = -1.0;
 
+/// Default response timeout for requests sent by the AsyncConnection
+const NSTimeInterval AsyncNetworkDefaultRequestTimeout = -1.0;
+
+/// Default maximum size of a body received by the AsyncConnection (after reassembly and decompression)
+const NSUInteger AsyncNetworkDefaultMaxBodySize = 67108864;
+
+/// Default body size from which the AsyncConnection compresses bodies (if enabled)
+const NSUInteger AsyncNetworkDefaultCompressionThreshold = 1024;
+
+/// Default batch size at which the AsyncConnection flushes batched frames (if enabled)
+const NSUInteger AsyncNetworkDefaultBatchMaxBytes = 65536;
+
+/// Default chunk size for streams sent by the AsyncConnection
+const NSUInteger AsyncNetworkDefaultStreamChunkSize = 65536;
+
+/// Default number of bytes the AsyncConnection queues for writing while streaming
+const NSUInteger AsyncNetworkDefaultStreamWindowSize = 262144;
+
+/// Default write queue size at which the AsyncConnection applies its write policy
+const NSUInteger AsyncNetworkDefaultWriteHighWatermark = 4194304;
+
+/// Default write queue size below which the AsyncConnection reports that the queue drained
+const NSUInteger AsyncNetworkDefaultWriteLowWatermark = 1048576;
+
+/// Default maximum body size of a fragment sent by the AsyncConnection
+const NSUInteger AsyncNetworkDefaultFragmentSize = 16384;
+
+/// Default number of bytes the AsyncConnection hands to the socket at once
+const NSUInteger AsyncNetworkDefaultWriteWindowSize = 65536;
+
+/// Default number of unanswered heartbeats after which the AsyncConnection disconnects
+const NSUInteger AsyncNetworkDefaultMaxMissedHeartbeats = 3;
+
+/// Default time after which the AsyncConnectionPool closes an idle connection
+const NSTimeInterval AsyncNetworkDefaultPoolIdleTimeout = 30.0;
+
+/// Default number of idle connections kept open by the AsyncConnectionPool
+const NSUInteger AsyncNetworkDefaultPoolMaxIdleConnections = 8;
+
+/// Default number of connections the AsyncConnectionPool opens to the same endpoint
+const NSUInteger AsyncNetworkDefaultPoolMaxConnectionsPerEndpoint = 2;
+
+/// Default number of pending requests on a pooled connection before the AsyncConnectionPool opens another one
+const NSUInteger AsyncNetworkDefaultPoolMaxRequestsPerConnection = 16;
+
+/// Default time after which an AsyncHedgingPolicy sends a request again (until enough latencies were observed)
+const NSTimeInterval AsyncNetworkDefaultHedgingDelay = 0.1;
+
+/// Default percentile (0-100) of the observed latencies after which an AsyncHedgingPolicy sends a request again
+const double AsyncNetworkDefaultHedgingPercentile = 95.0;
+
+/// Default number of observed latencies an AsyncHedgingPolicy requires before it uses the percentile
+const NSUInteger AsyncNetworkDefaultHedgingMinimumSamples = 20;
+
+/// Default ratio of hedged to sent requests allowed by an AsyncHedgingPolicy
+const double AsyncNetworkDefaultHedgingBudget = 0.1;
+
+/// Default number of hedges an AsyncHedgingPolicy may send in a row when its budget was saved up
+const NSUInteger AsyncNetworkDefaultHedgingBurst = 10;
+
+/// Default time the AsyncAddressCache keeps resolved addresses
+const NSTimeInterval AsyncNetworkDefaultAddressCacheTimeToLive = 60.0;
+
+/// Default part (0-1) of the time to live after which the AsyncAddressCache refreshes used addresses in the background
+const double AsyncNetworkDefaultAddressCacheRefreshThreshold = 0.75;
+
+// Error domain for errors reported by AsyncNetwork
+NSString *AsyncNetworkErrorDomain = @"AsyncNetwork";
+
 
 #pragma mark - Public Functions
 
@@ -59,7 +131,10 @@ const NSTimeInterval AsyncRequestDefaultTimeout = -1.0;
 static dispatch_queue_t _queue = NULL;
 extern dispatch_queue_t AsyncNetworkDispatchQueue()
 {
-	if (_queue == NULL)	_queue = dispatch_get_main_queue();
+	if (_queue == NULL)	{
+		_queue = dispatch_get_main_queue();
+		AsyncNetworkRegisterQueue(_queue);
+	}
 	return _queue;
 }
 
@@ -67,6 +142,38 @@ extern dispatch_queue_t AsyncNetworkDispatchQueue()
 extern void SetAsyncNetworkDispatchQueue(dispatch_queue_t queue)
 {
     _queue = queue;
+	if (queue) AsyncNetworkRegisterQueue(queue);
+}
+
+// every registered queue stores itself under this key
+static char AsyncNetworkQueueKey;
+
+/// Mark a serial queue so that AsyncNetworkPerformBlock can detect that it is running on it
+extern void AsyncNetworkRegisterQueue(dispatch_queue_t queue)
+{
+	dispatch_queue_set_specific(queue, &AsyncNetworkQueueKey, (__bridge void *)queue, NULL);
+}
+
+/// Run a block on a registered queue
+extern void AsyncNetworkPerformBlock(dispatch_queue_t queue, BOOL wait, dispatch_block_t block)
+{
+	if (dispatch_get_specific(&AsyncNetworkQueueKey) == (__bridge void *)queue) {
+		block();
+	} else if (wait) {
+		dispatch_sync(queue, block);
+	} else {
+		dispatch_async(queue, block);
+	}
+}
+
+/// Create a registered serial queue for a connection
+extern dispatch_queue_t AsyncNetworkCreateConnectionQueue(dispatch_queue_t targetQueue)
+{
+	dispatch_queue_t queue = dispatch_queue_create("AsyncNetwork.connection", DISPATCH_QUEUE_SERIAL);
+	if (!targetQueue) targetQueue = dispatch_get_global_queue(DISPATCH_QUEUE_PRIORITY_DEFAULT, 0);
+	dispatch_set_target_queue(queue, targetQueue);
+	AsyncNetworkRegisterQueue(queue);
+	return queue;
 }
 
 // return the local ip addresses
@@ -114,3 +221,34 @@ BOOL AsyncNetworkIPAddressIsLocal(NSString *address)
 	}
 	return [localIPAddresses containsObject:address];
 }
+
+// append an unsigned integer as a varint (7 bits per byte, least significant group first)
+void AsyncNetworkAppendVarint(NSMutableData *data, UInt64 value)
+{
+	UInt8 buffer[10];
+	NSUInteger length = 0;
+	while (value >= 0x80) {
+		buffer[length++] = (UInt8)(value | 0x80);
+		value >>= 7;
+	}
+	buffer[length++] = (UInt8)value;
+	[data appendBytes:buffer length:length];
+}
+
+// read a varint and advance the offset
+BOOL AsyncNetworkReadVarint(const UInt8 *bytes, NSUInteger length, NSUInteger *offset, UInt64 *value)
+{
+	UInt64 result = 0;
+	NSUInteger position = *offset;
+	for (NSUInteger shift = 0; shift < 64; shift += 7) {
+		if (position >= length) return NO;
+		UInt8 byte = bytes[position++];
+		result |= (UInt64)(byte & 0x7F) << shift;
+		if (!(byte & 0x80)) {
+			*offset = position;
+			*value = result;
+			return YES;
+		}
+	}
+	return NO;
+}
@@ -0,0 +1,45 @@
+/**
+ * Copyright (C) 2011 Jonathan Diehl
+ * 
+ * Permission is hereby granted, free of charge, to any person obtaining a copy of
+ * this software and associated documentation files (the "Software"), to deal in
+ * the Software without restriction, including without limitation the rights to
+ * use, copy, modify, merge, publish, distribute, sublicense, and/or sell copies
+ * of the Software, and to permit persons to whom the Software is furnished to do
+ * so, subject to the following conditions:
+ * 
+ * The above copyright notice and this permission notice shall be included in all
+ * copies or substantial portions of the Software.
+ * 
+ * THE SOFTWARE IS PROVIDED "AS IS", WITHOUT WARRANTY OF ANY KIND, EXPRESS OR
+ * IMPLIED, INCLUDING BUT NOT LIMITED TO THE WARRANTIES OF MERCHANTABILITY,
+ * FITNESS FOR A PARTICULAR PURPOSE AND NONINFRINGEMENT. IN NO EVENT SHALL THE
+ * AUTHORS OR COPYRIGHT HOLDERS BE LIABLE FOR ANY CLAIM, DAMAGES OR OTHER
+ * LIABILITY, WHETHER IN AN ACTION OF CONTRACT, TORT OR OTHERWISE, ARISING FROM,
+ * OUT OF OR IN CONNECTION WITH THE SOFTWARE OR THE USE OR OTHER DEALINGS IN THE
+ * SOFTWARE.
+ * 
+ * https://github.com/jdiehl/async-network
+ */
+
+#import <Foundation/Foundation.h>
+#import "AsyncNetworkHelpers.h"
+
+/**
+ @brief Table of response blocks waiting for a response, indexed by block tag
+ @details Tags are handed out sequentially and stored in an open addressed array
+ indexed by the lower bits of the tag, so lookups and removals neither hash nor box.
+ Entries are released as soon as their response arrives. Each entry also remembers
+ its command and when it was added, so that round trip times can be measured.
+ */
+@interface AsyncPendingRequests : NSObject
+
+@property (readonly) NSUInteger count; // number of outstanding requests
+
+- (UInt32)addResponseBlock:(AsyncNetworkResponseBlock)block;
+- (UInt32)addResponseBlock:(AsyncNetworkResponseBlock)block command:(UInt32)command;
+- (AsyncNetworkResponseBlock)removeResponseBlockForTag:(UInt32)tag;
+- (AsyncNetworkResponseBlock)removeResponseBlockForTag:(UInt32)tag command:(UInt32 *)command sendTime:(CFAbsoluteTime *)sendTime;
+- (NSArray *)removeAllResponseBlocks;
+
+@end
@@ -0,0 +1,182 @@
+/**
+ * Copyright (C) 2011 Jonathan Diehl
+ * 
+ * Permission is hereby granted, free of charge, to any person obtaining a copy of
+ * this software and associated documentation files (the "Software"), to deal in
+ * the Software without restriction, including without limitation the rights to
+ * use, copy, modify, merge, publish, distribute, sublicense, and/or sell copies
+ * of the Software, and to permit persons to whom the Software is furnished to do
+ * so, subject to the following conditions:
+ * 
+ * The above copyright notice and this permission notice shall be included in all
+ * copies or substantial portions of the Software.
+ * 
+ * THE SOFTWARE IS PROVIDED "AS IS", WITHOUT WARRANTY OF ANY KIND, EXPRESS OR
+ * IMPLIED, INCLUDING BUT NOT LIMITED TO THE WARRANTIES OF MERCHANTABILITY,
+ * FITNESS FOR A PARTICULAR PURPOSE AND NONINFRINGEMENT. IN NO EVENT SHALL THE
+ * AUTHORS OR COPYRIGHT HOLDERS BE LIABLE FOR ANY CLAIM, DAMAGES OR OTHER
+ * LIABILITY, WHETHER IN AN ACTION OF CONTRACT, TORT OR OTHERWISE, ARISING FROM,
+ * OUT OF OR IN CONNECTION WITH THE SOFTWARE OR THE USE OR OTHER DEALINGS IN THE
+ * SOFTWARE.
+ * 
+ * https://github.com/jdiehl/async-network
+ */
+
+#import "AsyncPendingRequests.h"
+
+#define AsyncPendingRequestsInitialCapacity 16
+
+// a slot in the table (tag 0 marks an empty slot)
+typedef struct {
+	UInt32 tag;
+	UInt32 command;
+	CFAbsoluteTime sendTime;
+	void *block; // retained AsyncNetworkResponseBlock
+} AsyncPendingRequest;
+
+@interface AsyncPendingRequests () {
+	AsyncPendingRequest *_slots;
+	NSUInteger _capacity;
+	NSUInteger _count;
+	UInt32 _currentTag;
+}
+- (NSUInteger)indexForTag:(UInt32)tag;
+- (void)grow;
+@end
+
+@implementation AsyncPendingRequests
+
+// init
+- (id)init;
+{
+	self = [super init];
+	if (self) {
+		_capacity = AsyncPendingRequestsInitialCapacity;
+		_slots = calloc(_capacity, sizeof(AsyncPendingRequest));
+		_count = 0;
+		_currentTag = 0;
+	}
+	return self;
+}
+
+// clean up
+- (void)dealloc;
+{
+	[self removeAllResponseBlocks];
+	free(_slots);
+}
+
+// number of outstanding requests
+- (NSUInteger)count;
+{
+	return _count;
+}
+
+// store a response block and return its new tag
+- (UInt32)addResponseBlock:(AsyncNetworkResponseBlock)block;
+{
+	return [self addResponseBlock:block command:0];
+}
+
+// store a response block with its command and return its new tag
+- (UInt32)addResponseBlock:(AsyncNetworkResponseBlock)block command:(UInt32)command;
+{
+	// keep the table at most half full so probe sequences stay short
+	if ((_count + 1) * 2 > _capacity) [self grow];
+	
+	// tag 0 is reserved for messages without a response, tags still pending after a wraparound are skipped
+	NSUInteger index;
+	do {
+		if (++_currentTag == 0) _currentTag = 1;
+		index = [self indexForTag:_currentTag];
+	} while (_slots[index].tag == _currentTag);
+	
+	AsyncPendingRequest *slot = &_slots[index];
+	slot->tag = _currentTag;
+	slot->command = command;
+	slot->sendTime = CFAbsoluteTimeGetCurrent();
+	slot->block = (void *)CFBridgingRetain([block copy]);
+	_count++;
+	return _currentTag;
+}
+
+// remove and return the response block for the given tag
+- (AsyncNetworkResponseBlock)removeResponseBlockForTag:(UInt32)tag;
+{
+	return [self removeResponseBlockForTag:tag command:NULL sendTime:NULL];
+}
+
+// remove and return the response block for the given tag together with its command and time of adding
+- (AsyncNetworkResponseBlock)removeResponseBlockForTag:(UInt32)tag command:(UInt32 *)command sendTime:(CFAbsoluteTime *)sendTime;
+{
+	if (tag == 0) return nil;
+	NSUInteger mask = _capacity - 1;
+	NSUInteger i = [self indexForTag:tag];
+	if (_slots[i].tag != tag) return nil;
+	if (command) *command = _slots[i].command;
+	if (sendTime) *sendTime = _slots[i].sendTime;
+	
+	AsyncNetworkResponseBlock block = CFBridgingRelease(_slots[i].block);
+	_slots[i].tag = 0;
+	_slots[i].block = NULL;
+	_count--;
+	
+	// shift following entries back into the gap so that lookups never stop early
+	NSUInteger j = i;
+	while (YES) {
+		j = (j + 1) & mask;
+		if (_slots[j].tag == 0) break;
+		NSUInteger home = _slots[j].tag & mask;
+		BOOL stays = (i <= j) ? (i < home && home <= j) : (i < home || home <= j);
+		if (stays) continue;
+		_slots[i] = _slots[j];
+		_slots[j].tag = 0;
+		_slots[j].block = NULL;
+		i = j;
+	}
+	
+	return block;
+}
+
+// remove and return all response blocks
+- (NSArray *)removeAllResponseBlocks;
+{
+	NSMutableArray *blocks = [NSMutableArray arrayWithCapacity:_count];
+	for (NSUInteger i = 0; i < _capacity && _count > 0; i++) {
+		if (_slots[i].tag == 0) continue;
+		[blocks addObject:CFBridgingRelease(_slots[i].block)];
+		_slots[i].tag = 0;
+		_slots[i].block = NULL;
+		_count--;
+	}
+	return blocks;
+}
+
+
+#pragma mark - Private Methods
+
+// index of the slot holding the tag or of the empty slot where it belongs
+// sequential tags land in consecutive slots, so this is almost always the first probe
+- (NSUInteger)indexForTag:(UInt32)tag;
+{
+	NSUInteger mask = _capacity - 1;
+	NSUInteger i = tag & mask;
+	while (_slots[i].tag != 0 && _slots[i].tag != tag) i = (i + 1) & mask;
+	return i;
+}
+
+// double the capacity and move all entries to their new slots
+- (void)grow;
+{
+	AsyncPendingRequest *oldSlots = _slots;
+	NSUInteger oldCapacity = _capacity;
+	_capacity = oldCapacity * 2;
+	_slots = calloc(_capacity, sizeof(AsyncPendingRequest));
+	for (NSUInteger i = 0; i < oldCapacity; i++) {
+		if (oldSlots[i].tag == 0) continue;
+		_slots[[self indexForTag:oldSlots[i].tag]] = oldSlots[i];
+	}
+	free(oldSlots);
+}
+
+@end
@@ -24,6 +24,8 @@
 
 #import <Foundation/Foundation.h>
 #import "AsyncConnection.h"
+#import "AsyncConnectionPool.h"
+#import "AsyncHedgingPolicy.h"
 
 /**
  @brief A request stores a remote host and port, as well as a request body to be sent once a connection was initiated
@@ -33,15 +35,21 @@
  */
 @interface AsyncRequest : NSObject <AsyncConnectionDelegate>
 
-@property (readonly) AsyncConnection *connection;
+@property (readonly) AsyncConnection *connection;          // own connection (only used without a pool)
+@property (strong) AsyncConnectionPool *pool;               // pool the request is sent through (default: shared pool, nil: own connection)
+@property (strong, nonatomic) dispatch_queue_t delegateQueue; // queue the request runs on (the pool's queue unless the pool is nil)
+@property (strong) dispatch_queue_t completionQueue;         // queue the response block is called on (default: main queue)
+@property (strong) AsyncHedgingPolicy *hedgingPolicy;        // sends the request to the alternate endpoints if it is slow (requires a pool)
+@property (readonly) NSArray *alternateEndpoints;           // NSNetService or "host:port" strings
 
-@property (assign) NSTimeInterval timeout;     // connection timeout
+@property (assign) NSTimeInterval timeout;     // response timeout
 @property (assign) AsyncCommand command;       // the command
 @property (strong) NSObject<NSCoding> *object; // connection object
 @property (copy) AsyncNetworkRequestBlock responseBlock; // connection response block
 
 
-+ (NSMutableSet *)activeRequests;
+// snapshot of the requests that were fired and did not finish yet
++ (NSSet *)activeRequests;
 
 + (id)fireRequestWithNetService:(NSNetService *)netService command:(AsyncCommand)command object:(NSObject<NSCoding> *)object responseBlock:(AsyncNetworkRequestBlock)block;
 + (id)fireRequestWithHost:(NSString *)host port:(NSUInteger)port command:(AsyncCommand)command object:(NSObject<NSCoding> *)object responseBlock:(AsyncNetworkRequestBlock)block;
@@ -49,6 +57,14 @@
 + (id)requestWithHost:(NSString *)theHost port:(NSUInteger)thePort;
 - (id)initWithNetService:(NSNetService *)netService;
 - (id)initWithHost:(NSString *)host port:(NSUInteger)port;
+
+// alternate endpoints serving the same requests (used by the hedging policy)
+- (void)addAlternateNetService:(NSNetService *)netService;
+- (void)addAlternateHost:(NSString *)host port:(NSUInteger)port;
+
 - (void)fire;
 
+// stop a fired request without calling the response block
+- (void)cancel;
+
 @end
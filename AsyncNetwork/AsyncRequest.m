@@ -24,23 +24,68 @@
 
 #import "AsyncRequest.h"
 
+@interface AsyncRequest () {
+	BOOL _responded;
+	BOOL _finished;                        // the response arrived (before the response block was called)
+	NSMutableArray *_alternateConnections; // endpoints of the alternates (never started)
+	dispatch_block_t _cancelBlock;         // cancels the fired request (access it @synchronized)
+}
++ (NSMutableSet *)activeRequestSet;
++ (void)addActiveRequest:(AsyncRequest *)request;
++ (void)removeActiveRequest:(AsyncRequest *)request;
+- (void)setCancelBlock:(dispatch_block_t)cancelBlock;
+- (id)sendThroughPoolToEndpoint:(AsyncConnection *)endpoint responseBlock:(AsyncNetworkResponseBlock)block;
+- (void)respondWithObject:(id)response error:(NSError *)error;
+@end
+
 @implementation AsyncRequest
 
 @synthesize connection = _connection;
+@synthesize pool = _pool;
+@synthesize completionQueue = _completionQueue;
+@synthesize hedgingPolicy = _hedgingPolicy;
 @synthesize timeout = _timeout;
 @synthesize command = _command;
 @synthesize object = _object;
 @synthesize responseBlock = _responseBlock;
 
 
-// active requests
-+ (NSSet *)activeRequests;
+// the set that keeps active requests alive (access it @synchronized)
++ (NSMutableSet *)activeRequestSet;
 {
 	static NSMutableSet *activeRequests = nil;
-	if (!activeRequests) activeRequests = [NSMutableSet new];
+	static dispatch_once_t once;
+	dispatch_once(&once, ^{ activeRequests = [NSMutableSet new]; });
 	return activeRequests;
 }
 
+// active requests
++ (NSSet *)activeRequests;
+{
+	NSMutableSet *activeRequests = [self activeRequestSet];
+	@synchronized(activeRequests) {
+		return [activeRequests copy];
+	}
+}
+
+// keep a fired request alive until it finished
++ (void)addActiveRequest:(AsyncRequest *)request;
+{
+	NSMutableSet *activeRequests = [self activeRequestSet];
+	@synchronized(activeRequests) {
+		[activeRequests addObject:request];
+	}
+}
+
+// release a finished request
++ (void)removeActiveRequest:(AsyncRequest *)request;
+{
+	NSMutableSet *activeRequests = [self activeRequestSet];
+	@synchronized(activeRequests) {
+		[activeRequests removeObject:request];
+	}
+}
+
 
 # pragma mark - Constructors
 
@@ -84,6 +129,9 @@
     self = [super init];
     if (self) {
 		self.timeout = AsyncRequestDefaultTimeout;
+		self.pool = [AsyncConnectionPool sharedPool];
+		self.completionQueue = dispatch_get_main_queue();
+		_alternateConnections = [NSMutableArray new];
     }
     
     return self;
@@ -120,29 +168,153 @@
 }
 
 
-#pragma mark - Responding on Main Thread
+#pragma mark - Custom Accessors
+
+// the request runs on the queue of the pool or of its own connection
+- (dispatch_queue_t)delegateQueue;
+{
+	return self.pool ? self.pool.delegateQueue : self.connection.delegateQueue;
+}
 
-// respond (on main thread)
-- (void)respondWithObject:(id)response;
+// the queue of the own connection (before firing the request)
+- (void)setDelegateQueue:(dispatch_queue_t)delegateQueue;
 {
-	self.responseBlock(response, nil);
+	// pooled connections share the queue of the pool
+	if (self.pool) NSLog(@"AsyncRequest: %@ is sent through a pool and runs on its queue (set the pool to nil to use the delegate queue)", self);
+	self.connection.delegateQueue = delegateQueue;
 }
 
-// respond (on main thread)
-- (void)respondWithError:(NSError *)error;
+// alternate endpoints
+- (NSArray *)alternateEndpoints;
 {
-	self.responseBlock(nil, error);
+	NSMutableArray *endpoints = [NSMutableArray arrayWithCapacity:_alternateConnections.count];
+	for (AsyncConnection *alternate in _alternateConnections) {
+		if (alternate.netService) {
+			[endpoints addObject:alternate.netService];
+		} else {
+			[endpoints addObject:[NSString stringWithFormat:@"%@:%lu", alternate.host, (unsigned long)alternate.port]];
+		}
+	}
+	return endpoints;
+}
+
+
+#pragma mark - Responding on the Completion Queue
+
+// hand the response or error to the response block on the completion queue
+- (void)didReceiveResponse:(id)response;
+{
+	[[self class] removeActiveRequest:self];
+	@synchronized(self) {
+		_finished = YES;
+		_cancelBlock = nil;
+	}
+	
+	// timeouts and disconnects are reported as errors
+	if ([response isKindOfClass:[NSError class]]) {
+		[self respondWithObject:nil error:response];
+	} else {
+		[self respondWithObject:response error:nil];
+	}
+}
+
+// respond once (on the completion queue)
+- (void)respondWithObject:(id)response error:(NSError *)error;
+{
+	AsyncNetworkRequestBlock block = self.responseBlock;
+	if (!block) return;
+	dispatch_queue_t queue = self.completionQueue ? self.completionQueue : dispatch_get_main_queue();
+	dispatch_async(queue, ^{
+		@synchronized(self) {
+			if (_responded) return;
+			_responded = YES;
+		}
+		block(response, error);
+	});
 }
 
 
 #pragma mark - Control methods
 
+// add an alternate net service
+- (void)addAlternateNetService:(NSNetService *)netService;
+{
+	[_alternateConnections addObject:[[AsyncConnection alloc] initWithNetService:netService]];
+}
+
+// add an alternate host and port
+- (void)addAlternateHost:(NSString *)host port:(NSUInteger)port;
+{
+	[_alternateConnections addObject:[[AsyncConnection alloc] initWithHost:host port:port]];
+}
+
 // fire the request and close the connection and call the completion block afterwards
 - (void)fire;
 {
-	[[[self class] activeRequests] addObject:self];
-	self.connection.delegate = self;
-	[self.connection start];
+	[[self class] addActiveRequest:self];
+	AsyncNetworkResponseBlock block = ^(id response) {
+		[self didReceiveResponse:response];
+	};
+	
+	// hedged requests go to the alternates in turn until one of them answers
+	if (self.pool && self.hedgingPolicy && _alternateConnections.count > 0) {
+		NSArray *endpoints = [[NSArray arrayWithObject:self.connection] arrayByAddingObjectsFromArray:_alternateConnections];
+		AsyncConnectionPool *pool = self.pool;
+		dispatch_block_t cancelBlock = [self.hedgingPolicy performRequestWithCommand:self.command attempts:endpoints.count attemptBlock:^dispatch_block_t(NSUInteger attempt, AsyncNetworkResponseBlock responseBlock) {
+			id poolRequest = [self sendThroughPoolToEndpoint:[endpoints objectAtIndex:attempt] responseBlock:responseBlock];
+			return ^{ [pool cancelRequest:poolRequest]; };
+		} responseBlock:block];
+		[self setCancelBlock:cancelBlock];
+		return;
+	}
+	
+	// pooled requests reuse an open connection to the same endpoint
+	if (self.pool) {
+		AsyncConnectionPool *pool = self.pool;
+		id poolRequest = [self sendThroughPoolToEndpoint:self.connection responseBlock:block];
+		[self setCancelBlock:^{ [pool cancelRequest:poolRequest]; }];
+		return;
+	}
+	
+	AsyncConnection *connection = self.connection;
+	[self setCancelBlock:^{ [connection cancel]; }];
+	connection.delegate = self;
+	[connection start];
+}
+
+// stop the request without calling the response block
+- (void)cancel;
+{
+	dispatch_block_t cancelBlock;
+	@synchronized(self) {
+		_responded = YES;
+		cancelBlock = _cancelBlock;
+		_cancelBlock = nil;
+	}
+	self.responseBlock = nil;
+	[[self class] removeActiveRequest:self];
+	if (cancelBlock) cancelBlock();
+}
+
+
+#pragma mark - Private Methods
+
+// keep the block that cancels the fired request (unless it already finished)
+- (void)setCancelBlock:(dispatch_block_t)cancelBlock;
+{
+	@synchronized(self) {
+		if (_finished || _responded) return;
+		_cancelBlock = [cancelBlock copy];
+	}
+}
+
+// send the request through the pool to the endpoint of a connection
+- (id)sendThroughPoolToEndpoint:(AsyncConnection *)endpoint responseBlock:(AsyncNetworkResponseBlock)block;
+{
+	if (endpoint.netService) {
+		return [self.pool sendCommand:self.command object:self.object toNetService:endpoint.netService timeout:self.timeout responseBlock:block];
+	}
+	return [self.pool sendCommand:self.command object:self.object toHost:endpoint.host port:endpoint.port timeout:self.timeout responseBlock:block];
 }
 
 
@@ -152,9 +324,9 @@
 - (void)connectionDidConnect:(AsyncConnection *)theConnection;
 {
 	if (self.command || self.object || self.responseBlock) {
-		[self.connection sendCommand:self.command object:self.object responseBlock:^(id response) {
+		[self.connection sendCommand:self.command object:self.object timeout:self.timeout responseBlock:^(id response) {
 			[self.connection cancel];
-			if (self.responseBlock) [self performSelectorOnMainThread:@selector(respondWithObject:) withObject:response waitUntilDone:NO];
+			[self didReceiveResponse:response];
 		}];
 	}
 }
@@ -162,14 +334,14 @@
 // disconnected
 - (void)connectionDidDisconnect:(AsyncConnection *)theConnection;
 {
-	[[[self class] activeRequests] removeObject:self];
+	[[self class] removeActiveRequest:self];
 }
 
 // a client failed with an error
 - (void)connection:(AsyncConnection *)theConnection didFailWithError:(NSError *)error;
 {
 	[self.connection cancel];
-	if (self.responseBlock) [self performSelectorOnMainThread:@selector(respondWithError:) withObject:error waitUntilDone:NO];
+	[self respondWithObject:nil error:error];
 }
 
 
@@ -0,0 +1,66 @@
+/**
+ * Copyright (C) 2011 Jonathan Diehl
+ * 
+ * Permission is hereby granted, free of charge, to any person obtaining a copy of
+ * this software and associated documentation files (the "Software"), to deal in
+ * the Software without restriction, including without limitation the rights to
+ * use, copy, modify, merge, publish, distribute, sublicense, and/or sell copies
+ * of the Software, and to permit persons to whom the Software is furnished to do
+ * so, subject to the following conditions:
+ * 
+ * The above copyright notice and this permission notice shall be included in all
+ * copies or substantial portions of the Software.
+ * 
+ * THE SOFTWARE IS PROVIDED "AS IS", WITHOUT WARRANTY OF ANY KIND, EXPRESS OR
+ * IMPLIED, INCLUDING BUT NOT LIMITED TO THE WARRANTIES OF MERCHANTABILITY,
+ * FITNESS FOR A PARTICULAR PURPOSE AND NONINFRINGEMENT. IN NO EVENT SHALL THE
+ * AUTHORS OR COPYRIGHT HOLDERS BE LIABLE FOR ANY CLAIM, DAMAGES OR OTHER
+ * LIABILITY, WHETHER IN AN ACTION OF CONTRACT, TORT OR OTHERWISE, ARISING FROM,
+ * OUT OF OR IN CONNECTION WITH THE SOFTWARE OR THE USE OR OTHER DEALINGS IN THE
+ * SOFTWARE.
+ * 
+ * https://github.com/jdiehl/async-network
+ */
+
+#import <Foundation/Foundation.h>
+#import "AsyncRequest.h"
+
+/// When an AsyncRequestGroup calls its completion block
+typedef enum {
+	AsyncRequestGroupCompletionAll = 0,            // once every endpoint answered or failed (default)
+	AsyncRequestGroupCompletionFirstResponses = 1, // once requiredResponses endpoints answered
+	AsyncRequestGroupCompletionQuorum = 2          // once a majority of the endpoints answered
+} AsyncRequestGroupCompletion;
+
+/// responses and errors map endpoints (NSNetService or "host:port") to the response or NSError
+typedef void (^AsyncRequestGroupBlock)(NSDictionary *responses, NSDictionary *errors);
+
+/**
+ @brief A request group sends the same request to many endpoints and calls back once with all results
+ @details Requests are sent concurrently (up to maxConcurrentRequests at a time) through the connection pool.
+ Endpoints that did not answer before the deadline are reported with AsyncNetworkErrorRequestTimeout. If the
+ group completes early (first responses or quorum) or is cancelled, requests that were not sent yet are skipped
+ and requests still in flight are cancelled. The completion block is called on the main thread.
+ */
+@interface AsyncRequestGroup : NSObject
+
+@property (readonly) NSArray *endpoints;         // NSNetService or "host:port" strings
+@property (assign) AsyncCommand command;          // the command
+@property (strong) NSObject<NSCoding> *object;    // the request object
+@property (assign) NSTimeInterval deadline;       // time until all endpoints must have answered (<= 0: none)
+@property (assign) NSUInteger maxConcurrentRequests; // requests in flight at the same time (0: all at once)
+@property (assign) AsyncRequestGroupCompletion completion; // when the group completes
+@property (assign) NSUInteger requiredResponses;  // responses required by AsyncRequestGroupCompletionFirstResponses
+@property (strong) AsyncConnectionPool *pool;     // pool the requests are sent through (default: shared pool, nil: own connections)
+@property (copy) AsyncRequestGroupBlock completionBlock;
+@property (readonly) BOOL completed;
+
++ (id)fireGroupWithNetServices:(NSArray *)netServices command:(AsyncCommand)command object:(NSObject<NSCoding> *)object deadline:(NSTimeInterval)deadline completionBlock:(AsyncRequestGroupBlock)block;
+
+// adding an endpoint that is already part of the group has no effect
+- (void)addNetService:(NSNetService *)netService;
+- (void)addHost:(NSString *)host port:(NSUInteger)port;
+- (void)fire;
+- (void)cancel;
+
+@end
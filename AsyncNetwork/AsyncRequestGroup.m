@@ -0,0 +1,251 @@
+/**
+ * Copyright (C) 2011 Jonathan Diehl
+ * 
+ * Permission is hereby granted, free of charge, to any person obtaining a copy of
+ * this software and associated documentation files (the "Software"), to deal in
+ * the Software without restriction, including without limitation the rights to
+ * use, copy, modify, merge, publish, distribute, sublicense, and/or sell copies
+ * of the Software, and to permit persons to whom the Software is furnished to do
+ * so, subject to the following conditions:
+ * 
+ * The above copyright notice and this permission notice shall be included in all
+ * copies or substantial portions of the Software.
+ * 
+ * THE SOFTWARE IS PROVIDED "AS IS", WITHOUT WARRANTY OF ANY KIND, EXPRESS OR
+ * IMPLIED, INCLUDING BUT NOT LIMITED TO THE WARRANTIES OF MERCHANTABILITY,
+ * FITNESS FOR A PARTICULAR PURPOSE AND NONINFRINGEMENT. IN NO EVENT SHALL THE
+ * AUTHORS OR COPYRIGHT HOLDERS BE LIABLE FOR ANY CLAIM, DAMAGES OR OTHER
+ * LIABILITY, WHETHER IN AN ACTION OF CONTRACT, TORT OR OTHERWISE, ARISING FROM,
+ * OUT OF OR IN CONNECTION WITH THE SOFTWARE OR THE USE OR OTHER DEALINGS IN THE
+ * SOFTWARE.
+ * 
+ * https://github.com/jdiehl/async-network
+ */
+
+#import "AsyncRequestGroup.h"
+
+// private state
+@interface AsyncRequestGroup () {
+	NSMutableArray *_endpoints;
+	NSMutableArray *_requests;       // one request per endpoint (same order)
+	NSUInteger _nextRequest;         // index of the next request to send
+	NSUInteger _outstandingRequests; // sent without a response yet
+	NSMutableDictionary *_responses;
+	NSMutableDictionary *_errors;
+	BOOL _fired;
+}
+- (void)addEndpoint:(id)endpoint request:(AsyncRequest *)request;
+- (NSUInteger)requiredResponseCount;
+- (void)sendNextRequests;
+- (void)request:(AsyncRequest *)request endpoint:(id)endpoint didFinishWithResponse:(id)response error:(NSError *)error;
+- (void)checkCompletion;
+- (void)completeWithTimeout:(BOOL)timeout;
+- (void)cancelOutstandingRequests;
+@end
+
+
+@implementation AsyncRequestGroup
+
+@synthesize endpoints = _endpoints;
+@synthesize command = _command;
+@synthesize object = _object;
+@synthesize deadline = _deadline;
+@synthesize maxConcurrentRequests = _maxConcurrentRequests;
+@synthesize completion = _completion;
+@synthesize requiredResponses = _requiredResponses;
+@synthesize pool = _pool;
+@synthesize completionBlock = _completionBlock;
+@synthesize completed = _completed;
+
+// fire a request to all net services and call the completion block once
++ (id)fireGroupWithNetServices:(NSArray *)netServices command:(AsyncCommand)command object:(NSObject<NSCoding> *)object deadline:(NSTimeInterval)deadline completionBlock:(AsyncRequestGroupBlock)block;
+{
+	AsyncRequestGroup *group = [self new];
+	for (NSNetService *netService in netServices) {
+		[group addNetService:netService];
+	}
+	group.command = command;
+	group.object = object;
+	group.deadline = deadline;
+	group.completionBlock = block;
+	[group fire];
+	return group;
+}
+
+// init
+- (id)init;
+{
+	self = [super init];
+	if (self) {
+		self.deadline = AsyncRequestDefaultTimeout;
+		self.maxConcurrentRequests = 0;
+		self.completion = AsyncRequestGroupCompletionAll;
+		self.requiredResponses = 1;
+		self.pool = [AsyncConnectionPool sharedPool];
+		_endpoints = [NSMutableArray new];
+		_requests = [NSMutableArray new];
+		
+		// endpoints are used as keys without copying them (NSNetService does not conform to NSCopying)
+		_responses = (__bridge_transfer NSMutableDictionary *)CFDictionaryCreateMutable(NULL, 0, &kCFTypeDictionaryKeyCallBacks, &kCFTypeDictionaryValueCallBacks);
+		_errors = (__bridge_transfer NSMutableDictionary *)CFDictionaryCreateMutable(NULL, 0, &kCFTypeDictionaryKeyCallBacks, &kCFTypeDictionaryValueCallBacks);
+	}
+	return self;
+}
+
+// debug description
+- (NSString *)description;
+{
+#ifdef __LP64__
+	return [NSString stringWithFormat:@"<%s endpoints=%ld responses=%ld errors=%ld>", object_getClassName(self), _endpoints.count, _responses.count, _errors.count];
+#else
+	return [NSString stringWithFormat:@"<%s endpoints=%d responses=%d errors=%d>", object_getClassName(self), _endpoints.count, _responses.count, _errors.count];
+#endif
+}
+
+
+#pragma mark - Control Methods
+
+// add a net service endpoint
+- (void)addNetService:(NSNetService *)netService;
+{
+	[self addEndpoint:netService request:[AsyncRequest requestWithNetService:netService]];
+}
+
+// add a host and port endpoint
+- (void)addHost:(NSString *)host port:(NSUInteger)port;
+{
+	NSString *endpoint = [NSString stringWithFormat:@"%@:%lu", host, (unsigned long)port];
+	[self addEndpoint:endpoint request:[AsyncRequest requestWithHost:host port:port]];
+}
+
+// send the requests (on the main thread)
+- (void)fire;
+{
+	if (_fired) return;
+	_fired = YES;
+	
+	// complete at the deadline with the results so far
+	if (self.deadline > 0) {
+		dispatch_after(dispatch_time(DISPATCH_TIME_NOW, (int64_t)(self.deadline * NSEC_PER_SEC)), dispatch_get_main_queue(), ^{
+			[self completeWithTimeout:YES];
+		});
+	}
+	
+	[self sendNextRequests];
+	[self checkCompletion];
+}
+
+// stop without calling the completion block
+- (void)cancel;
+{
+	_completed = YES;
+	self.completionBlock = nil;
+	[self cancelOutstandingRequests];
+}
+
+
+#pragma mark - Private Methods
+
+// add an endpoint with its request
+- (void)addEndpoint:(id)endpoint request:(AsyncRequest *)request;
+{
+	NSAssert(!_fired, @"AsyncRequestGroup: endpoints must be added before firing");
+	
+	// results are keyed by endpoint, so a duplicate would never be answered and block completion
+	if ([_endpoints containsObject:endpoint]) return;
+	[_endpoints addObject:endpoint];
+	[_requests addObject:request];
+}
+
+// number of responses after which the group completes
+- (NSUInteger)requiredResponseCount;
+{
+	switch (self.completion) {
+		case AsyncRequestGroupCompletionFirstResponses:
+			return MIN(MAX(self.requiredResponses, 1), _endpoints.count);
+		case AsyncRequestGroupCompletionQuorum:
+			return _endpoints.count / 2 + 1;
+		default:
+			return _endpoints.count;
+	}
+}
+
+// send requests until the concurrency limit is reached
+- (void)sendNextRequests;
+{
+	while (!_completed && _nextRequest < _requests.count && (self.maxConcurrentRequests == 0 || _outstandingRequests < self.maxConcurrentRequests)) {
+		AsyncRequest *request = [_requests objectAtIndex:_nextRequest];
+		id endpoint = [_endpoints objectAtIndex:_nextRequest];
+		_nextRequest++;
+		_outstandingRequests++;
+		
+		request.command = self.command;
+		request.object = self.object;
+		request.timeout = self.deadline;
+		request.pool = self.pool;
+		request.completionQueue = dispatch_get_main_queue(); // the group state lives on the main thread
+		request.responseBlock = ^(id<NSCoding> response, NSError *error) {
+			[self request:request endpoint:endpoint didFinishWithResponse:response error:error];
+		};
+		[request fire];
+	}
+}
+
+// a request was answered or failed (on the main thread)
+- (void)request:(AsyncRequest *)request endpoint:(id)endpoint didFinishWithResponse:(id)response error:(NSError *)error;
+{
+	request.responseBlock = nil;
+	if (_completed) return;
+	_outstandingRequests--;
+	if (error) {
+		[_errors setObject:error forKey:endpoint];
+	} else {
+		[_responses setObject:(response ? response : [NSNull null]) forKey:endpoint];
+	}
+	[self sendNextRequests];
+	[self checkCompletion];
+}
+
+// complete once enough endpoints answered or enough failed that it is no longer possible
+- (void)checkCompletion;
+{
+	if (_completed) return;
+	NSUInteger required = [self requiredResponseCount];
+	NSUInteger possible = _endpoints.count - _errors.count;
+	if (_responses.count >= required || possible < required || _responses.count + _errors.count == _endpoints.count) {
+		[self completeWithTimeout:NO];
+	}
+}
+
+// call the completion block (endpoints without an answer time out)
+- (void)completeWithTimeout:(BOOL)timeout;
+{
+	if (_completed) return;
+	_completed = YES;
+	[self cancelOutstandingRequests];
+	
+	if (timeout) {
+		NSError *error = [NSError errorWithDomain:AsyncNetworkErrorDomain code:AsyncNetworkErrorRequestTimeout userInfo:nil];
+		for (id endpoint in _endpoints) {
+			if (![_responses objectForKey:endpoint] && ![_errors objectForKey:endpoint]) [_errors setObject:error forKey:endpoint];
+		}
+	}
+	
+	AsyncRequestGroupBlock block = self.completionBlock;
+	self.completionBlock = nil;
+	if (block) block([_responses copy], [_errors copy]);
+}
+
+
+// stop the requests that were sent without an answer yet
+- (void)cancelOutstandingRequests;
+{
+	for (NSUInteger i = 0; i < _nextRequest; i++) {
+		AsyncRequest *request = [_requests objectAtIndex:i];
+		if (request.responseBlock) [request cancel];
+	}
+	_outstandingRequests = 0;
+}
+
+
+@end
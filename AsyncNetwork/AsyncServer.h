@@ -38,10 +38,21 @@
 - (void)server:(AsyncServer *)theServer didDisconnect:(AsyncConnection *)connection;
 - (void)server:(AsyncServer *)theServer didReceiveCommand:(AsyncCommand)command object:(id)object connection:(AsyncConnection *)connection;
 - (void)server:(AsyncServer *)theServer didReceiveCommand:(AsyncCommand)command object:(id)object connection:(AsyncConnection *)connection responseBlock:(AsyncNetworkResponseBlock)block;
+- (void)server:(AsyncServer *)theServer didReceiveChunk:(NSData *)chunk forCommand:(AsyncCommand)command stream:(UInt32)streamID finished:(BOOL)finished connection:(AsyncConnection *)connection;
 - (void)server:(AsyncServer *)theServer didFailWithError:(NSError *)error;
+- (void)server:(AsyncServer *)theServer didReachHighWatermark:(AsyncConnection *)connection;
+- (void)server:(AsyncServer *)theServer didDrainToLowWatermark:(AsyncConnection *)connection;
+- (void)server:(AsyncServer *)theServer didSubscribeToTopic:(NSString *)topic connection:(AsyncConnection *)connection;
+- (void)server:(AsyncServer *)theServer didUnsubscribeFromTopic:(NSString *)topic connection:(AsyncConnection *)connection;
 
 @end
 
+/// How accepted connections are spread across the workers of a server
+typedef enum {
+	AsyncServerWorkerAssignmentRoundRobin = 0,  // one worker after the other (default)
+	AsyncServerWorkerAssignmentLeastLoaded = 1  // the worker with the fewest connections
+} AsyncServerWorkerAssignment;
+
 /// A server can accept connections from AsyncConnection objects.
 @interface AsyncServer : NSObject <NSNetServiceDelegate, GCDAsyncSocketDelegate, AsyncConnectionDelegate>
 
@@ -50,17 +61,58 @@
 @property (readonly) NSMutableSet *connections;
 
 @property (unsafe_unretained) id<AsyncServerDelegate> delegate;
+@property (strong, nonatomic) dispatch_queue_t delegateQueue; // serial queue for the listen socket, connections and server state (default: AsyncNetworkDispatchQueue())
+
+// with connection queues each connection calls back on its own serial queue and connections are processed in parallel
+// call the server on its delegate queue, connection callbacks must not block on it
+@property (assign) BOOL connectionQueuesEnabled;            // give each new connection its own queue (default: NO)
+@property (strong) dispatch_queue_t connectionTargetQueue;  // concurrent pool the connection queues target (default: global queue)
+
+// workers spread the connections over several cores, each worker has its own delegate and socket queue
+// connections of a worker share its delegate queue (this replaces connection queues), set these before starting
+@property (assign) NSUInteger workerCount;                           // number of workers (0: no workers, default)
+@property (assign) AsyncServerWorkerAssignment workerAssignment;     // how connections are assigned to workers
+@property (readonly) NSArray *workerConnectionCounts;                // number of connections per worker (NSNumber)
+
 @property (strong) NSString *serviceType;
 @property (strong) NSString *serviceDomain;
 @property (strong, nonatomic) NSString *serviceName;
 @property (assign) NSInteger port;
 @property (assign) BOOL includesPeerToPeer;
+@property (strong) id<AsyncCodec> codec; // codec for new connections and broadcasts (default: AsyncKeyedArchiverCodec)
+@property (assign) BOOL compressionEnabled; // compress large bodies on new connections (default: NO)
+@property (assign) NSUInteger compressionThreshold; // minimum body size for compression
+@property (assign) BOOL batchingEnabled;        // batch outgoing frames on new connections (default: NO)
+@property (assign) NSTimeInterval batchMaxDelay; // maximum delay of batched frames
+@property (assign) NSUInteger batchMaxBytes;     // maximum size of a batch
+@property (assign) NSUInteger writeHighWatermark;  // write queue size at which new connections apply the write policy
+@property (assign) NSUInteger writeLowWatermark;   // write queue size at which new connections report that the queue drained
+@property (assign) AsyncConnectionWritePolicy writePolicy; // write policy of new connections (default: queue)
+@property (assign) NSTimeInterval heartbeatInterval; // heartbeat interval of new connections (0: no heartbeat, default)
+@property (assign) NSUInteger maxMissedHeartbeats;   // new connections disconnect after this many unanswered pings
 
 - (void)start;
 - (void)stop;
+- (void)flush;
+
+// the priority applies to all current and future connections
+- (void)setPriority:(AsyncConnectionPriority)priority forCommand:(AsyncCommand)command;
+
+// counters of all current and closed connections (times are summed up)
+- (AsyncConnectionCounters)counters;
+- (NSDictionary *)sentFramesByCommand;
+- (NSDictionary *)receivedFramesByCommand;
+- (NSDictionary *)latencyHistograms;
 
 - (void)sendCommand:(AsyncCommand)command object:(id<NSCoding>)object responseBlock:(AsyncNetworkResponseBlock)block;
 - (void)sendCommand:(AsyncCommand)command object:(id<NSCoding>)object;
 - (void)sendObject:(id<NSCoding>)object;
+- (void)sendCommand:(AsyncCommand)command data:(NSData *)data responseBlock:(AsyncNetworkResponseBlock)block;
+- (void)sendCommand:(AsyncCommand)command data:(NSData *)data;
+
+// published messages only go to connections that subscribed to the topic (or to a prefix of it ending in *)
+- (NSSet *)subscribersForTopic:(NSString *)topic;
+- (void)publishCommand:(AsyncCommand)command object:(id<NSCoding>)object topic:(NSString *)topic;
+- (void)publishCommand:(AsyncCommand)command data:(NSData *)data topic:(NSString *)topic;
 
 @end
@@ -23,12 +23,42 @@
  */
 
 #import "AsyncServer.h"
+#import "AsyncTrace.h"
+
+
+// a worker runs the sockets and delegate callbacks of its connections on its own queues
+@interface AsyncServerWorker : NSObject
+@property (strong) dispatch_queue_t delegateQueue;
+@property (strong) dispatch_queue_t socketQueue;
+@property (assign) NSUInteger connectionCount;
+@end
+
+@implementation AsyncServerWorker
+@synthesize delegateQueue = _delegateQueue;
+@synthesize socketQueue = _socketQueue;
+@synthesize connectionCount = _connectionCount;
+@end
 
 
 // private methods
-@interface AsyncServer ()
+@interface AsyncServer () {
+	NSArray *_workers;
+	NSMutableArray *_acceptingWorkers; // workers chosen for accepted sockets that were not yet handed to us
+	NSUInteger _nextWorker;
+	NSMutableDictionary *_topicSubscribers; // subscribed topic -> connections
+	NSMutableDictionary *_commandPriorities;
+	AsyncConnectionCounters _closedCounters;
+	NSMutableDictionary *_closedSentFramesByCommand;
+	NSMutableDictionary *_closedReceivedFramesByCommand;
+	NSMutableDictionary *_closedLatencyHistograms;
+}
 - (void)setupListenSocket;
 - (void)setupNetService;
+- (void)setupWorkers;
+- (AsyncServerWorker *)workerForQueue:(dispatch_queue_t)queue;
+- (void)sendCommand:(AsyncCommand)command object:(id<NSCoding>)object responseBlock:(AsyncNetworkResponseBlock)block connections:(id<NSFastEnumeration>)connections;
+- (void)sendCommand:(AsyncCommand)command data:(NSData *)data responseBlock:(AsyncNetworkResponseBlock)block connections:(id<NSFastEnumeration>)connections;
+- (void)removeSubscriber:(AsyncConnection *)connection fromTopic:(NSString *)topic;
 @end
 
 
@@ -38,11 +68,27 @@
 @synthesize netService = _netService;
 @synthesize connections = _connections;
 @synthesize delegate = _delegate;
+@synthesize delegateQueue = _delegateQueue;
+@synthesize connectionQueuesEnabled = _connectionQueuesEnabled;
+@synthesize connectionTargetQueue = _connectionTargetQueue;
+@synthesize workerCount = _workerCount;
+@synthesize workerAssignment = _workerAssignment;
 @synthesize serviceType = _serviceType;
 @synthesize serviceDomain = _serviceDomain;
 @synthesize serviceName = _serviceName;
 @synthesize port = _port;
 @synthesize includesPeerToPeer = _includesPeerToPeer;
+@synthesize codec = _codec;
+@synthesize compressionEnabled = _compressionEnabled;
+@synthesize compressionThreshold = _compressionThreshold;
+@synthesize batchingEnabled = _batchingEnabled;
+@synthesize batchMaxDelay = _batchMaxDelay;
+@synthesize batchMaxBytes = _batchMaxBytes;
+@synthesize writeHighWatermark = _writeHighWatermark;
+@synthesize writeLowWatermark = _writeLowWatermark;
+@synthesize writePolicy = _writePolicy;
+@synthesize heartbeatInterval = _heartbeatInterval;
+@synthesize maxMissedHeartbeats = _maxMissedHeartbeats;
 
 // init
 - (id)init
@@ -53,6 +99,26 @@
 		self.includesPeerToPeer = NO;
 		self.serviceType = AsyncNetworkDefaultServiceType;
 		self.serviceDomain = AsyncNetworkDefaultServiceDomain;
+		self.codec = [AsyncKeyedArchiverCodec codec];
+		self.compressionEnabled = NO;
+		self.compressionThreshold = AsyncNetworkDefaultCompressionThreshold;
+		self.batchingEnabled = NO;
+		self.batchMaxDelay = 0.0;
+		self.batchMaxBytes = AsyncNetworkDefaultBatchMaxBytes;
+		self.writeHighWatermark = AsyncNetworkDefaultWriteHighWatermark;
+		self.writeLowWatermark = AsyncNetworkDefaultWriteLowWatermark;
+		self.writePolicy = AsyncConnectionWritePolicyQueue;
+		self.heartbeatInterval = 0.0;
+		self.maxMissedHeartbeats = AsyncNetworkDefaultMaxMissedHeartbeats;
+		self.connectionQueuesEnabled = NO;
+		self.workerCount = 0;
+		self.workerAssignment = AsyncServerWorkerAssignmentRoundRobin;
+		_acceptingWorkers = [NSMutableArray new];
+		_topicSubscribers = [NSMutableDictionary new];
+		_commandPriorities = [NSMutableDictionary new];
+		_closedSentFramesByCommand = [NSMutableDictionary new];
+		_closedReceivedFramesByCommand = [NSMutableDictionary new];
+		_closedLatencyHistograms = [NSMutableDictionary new];
 	}
 	return self;
 }
@@ -84,6 +150,7 @@
 // start the async server
 - (void)start;
 {
+    [self setupWorkers];
     [self setupListenSocket];
     [self setupNetService];
 }
@@ -103,20 +170,127 @@
         _listenSocket = nil;
     }
     
-    // close open connections
+    // close open connections (on their queues, a worker may be calling the delegate right now)
 	for (AsyncConnection *connection in self.connections) {
-		connection.delegate = nil;
-		[connection cancel];
+		[connection performBlockAndWait:^{
+			connection.delegate = nil;
+			[connection cancel];
+		}];
 	}
 	[self.connections removeAllObjects];
+	[_topicSubscribers removeAllObjects];
+	@synchronized(_acceptingWorkers) {
+		for (AsyncServerWorker *worker in _workers) worker.connectionCount = 0;
+		[_acceptingWorkers removeAllObjects];
+	}
+}
+
+// write the batched frames of all connections
+- (void)flush;
+{
+	for (AsyncConnection *connection in self.connections) {
+		[connection performBlock:^{
+			[connection flush];
+		}];
+	}
+}
+
+// counters of all current and closed connections
+- (AsyncConnectionCounters)counters;
+{
+	__block AsyncConnectionCounters counters = _closedCounters;
+	for (AsyncConnection *connection in self.connections) {
+		[connection performBlockAndWait:^{
+			AsyncConnectionAddCounters(&counters, connection.counters);
+		}];
+	}
+	return counters;
+}
+
+// messages, requests and stream chunks sent by command on all current and closed connections
+- (NSDictionary *)sentFramesByCommand;
+{
+	NSMutableDictionary *counts = [_closedSentFramesByCommand mutableCopy];
+	for (AsyncConnection *connection in self.connections) {
+		[connection performBlockAndWait:^{
+			AsyncConnectionAddCommandCounts(counts, connection.sentFramesByCommand);
+		}];
+	}
+	return counts;
+}
+
+// messages, requests and stream chunks received by command on all current and closed connections
+- (NSDictionary *)receivedFramesByCommand;
+{
+	NSMutableDictionary *counts = [_closedReceivedFramesByCommand mutableCopy];
+	for (AsyncConnection *connection in self.connections) {
+		[connection performBlockAndWait:^{
+			AsyncConnectionAddCommandCounts(counts, connection.receivedFramesByCommand);
+		}];
+	}
+	return counts;
+}
+
+// round trip times by command on all current and closed connections
+- (NSDictionary *)latencyHistograms;
+{
+	NSMutableDictionary *histograms = [NSMutableDictionary dictionary];
+	[AsyncLatencyHistogram addHistograms:_closedLatencyHistograms toHistograms:histograms];
+	for (AsyncConnection *connection in self.connections) {
+		[connection performBlockAndWait:^{
+			[AsyncLatencyHistogram addHistograms:connection.latencyHistograms toHistograms:histograms];
+		}];
+	}
+	return histograms;
+}
+
+// number of connections per worker
+- (NSArray *)workerConnectionCounts;
+{
+	NSMutableArray *counts = [NSMutableArray arrayWithCapacity:_workers.count];
+	@synchronized(_acceptingWorkers) {
+		for (AsyncServerWorker *worker in _workers) {
+			[counts addObject:[NSNumber numberWithUnsignedInteger:worker.connectionCount]];
+		}
+	}
+	return counts;
+}
+
+// set the priority lane of a command on all connections
+- (void)setPriority:(AsyncConnectionPriority)priority forCommand:(AsyncCommand)command;
+{
+	[_commandPriorities setObject:[NSNumber numberWithInt:priority] forKey:[NSNumber numberWithUnsignedInt:command]];
+	for (AsyncConnection *connection in self.connections) {
+		[connection performBlock:^{
+			[connection setPriority:priority forCommand:command];
+		}];
+	}
 }
 
 // send command and object with response block
 - (void)sendCommand:(AsyncCommand)command object:(id<NSCoding>)object responseBlock:(AsyncNetworkResponseBlock)block;
 {
-	for (AsyncConnection *connection in self.connections) {
-		if (![connection connected]) continue;
-		[connection sendCommand:command object:object responseBlock:block];
+	[self sendCommand:command object:object responseBlock:block connections:self.connections];
+}
+
+// send command and object to the given connections
+- (void)sendCommand:(AsyncCommand)command object:(id<NSCoding>)object responseBlock:(AsyncNetworkResponseBlock)block connections:(id<NSFastEnumeration>)connections;
+{
+	// encode once and share the immutable body with all connections
+	NSData *body = nil;
+	AsyncCodecID codecID = 0;
+	if (object) {
+		id<AsyncCodec> codec = self.codec;
+		CFAbsoluteTime start = CFAbsoluteTimeGetCurrent();
+		body = [[codec encodeObject:object] copy];
+		AsyncTraceRecord("encode", (__bridge void *)self, command, 0, start, CFAbsoluteTimeGetCurrent());
+		codecID = codec.codecID;
+	}
+	
+	for (AsyncConnection *connection in connections) {
+		[connection performBlock:^{
+			if ([connection connected]) [connection sendCommand:command body:body codecID:codecID responseBlock:block];
+		}];
 	}
 }
 
@@ -132,9 +306,74 @@
 	[self sendCommand:0 object:object responseBlock:nil];
 }
 
+// send command and raw data with response block
+- (void)sendCommand:(AsyncCommand)command data:(NSData *)data responseBlock:(AsyncNetworkResponseBlock)block;
+{
+	[self sendCommand:command data:data responseBlock:block connections:self.connections];
+}
+
+// send command and raw data to the given connections
+- (void)sendCommand:(AsyncCommand)command data:(NSData *)data responseBlock:(AsyncNetworkResponseBlock)block connections:(id<NSFastEnumeration>)connections;
+{
+	for (AsyncConnection *connection in connections) {
+		[connection performBlock:^{
+			if ([connection connected]) [connection sendCommand:command data:data responseBlock:block];
+		}];
+	}
+}
+
+// send command and raw data without response block
+- (void)sendCommand:(AsyncCommand)command data:(NSData *)data;
+{
+	[self sendCommand:command data:data responseBlock:nil];
+}
+
+
+// connections subscribed to the topic itself or to a prefix of it
+- (NSSet *)subscribersForTopic:(NSString *)topic;
+{
+	NSMutableSet *subscribers = [NSMutableSet new];
+	NSSet *exact = [_topicSubscribers objectForKey:topic];
+	if (exact) [subscribers unionSet:exact];
+	for (NSUInteger i = 0; i <= topic.length; i++) {
+		NSSet *prefixed = [_topicSubscribers objectForKey:[[topic substringToIndex:i] stringByAppendingString:@"*"]];
+		if (prefixed) [subscribers unionSet:prefixed];
+	}
+	return subscribers;
+}
+
+// publish command and object to the subscribers of a topic
+- (void)publishCommand:(AsyncCommand)command object:(id<NSCoding>)object topic:(NSString *)topic;
+{
+	NSSet *subscribers = [self subscribersForTopic:topic];
+	if (subscribers.count == 0) return;
+	[self sendCommand:command object:object responseBlock:nil connections:subscribers];
+}
+
+// publish command and raw data to the subscribers of a topic
+- (void)publishCommand:(AsyncCommand)command data:(NSData *)data topic:(NSString *)topic;
+{
+	NSSet *subscribers = [self subscribersForTopic:topic];
+	if (subscribers.count == 0) return;
+	[self sendCommand:command data:data responseBlock:nil connections:subscribers];
+}
+
 
 #pragma mark - Custom Accessors
 
+// the delegate queue defaults to the global AsyncNetwork queue
+- (dispatch_queue_t)delegateQueue;
+{
+	return _delegateQueue ? _delegateQueue : AsyncNetworkDispatchQueue();
+}
+
+// set the delegate queue (before starting the server)
+- (void)setDelegateQueue:(dispatch_queue_t)delegateQueue;
+{
+	if (delegateQueue) AsyncNetworkRegisterQueue(delegateQueue);
+	_delegateQueue = delegateQueue;
+}
+
 // setting the service name restarts the net service
 - (void)setServiceName:(NSString *)serviceName;
 {
@@ -157,7 +396,7 @@
 	if(self.listenSocket) return;
 	
 	// set up listening socket
-	_listenSocket = [[GCDAsyncSocket alloc] initWithDelegate:self delegateQueue:AsyncNetworkDispatchQueue()];
+	_listenSocket = [[GCDAsyncSocket alloc] initWithDelegate:self delegateQueue:self.delegateQueue];
 	[self.listenSocket setIPv6Enabled:YES];
 	NSError *error;
 	if (![self.listenSocket acceptOnPort:self.port error:&error]) {
@@ -172,6 +411,41 @@
 	_port = [self.listenSocket localPort];
 }
 
+// set up the worker queues (the workers are kept until the worker count changes)
+- (void)setupWorkers;
+{
+	if (_workers.count == self.workerCount) return;
+	
+	NSMutableArray *workers = [NSMutableArray arrayWithCapacity:self.workerCount];
+	for (NSUInteger i = 0; i < self.workerCount; i++) {
+		AsyncServerWorker *worker = [AsyncServerWorker new];
+		worker.delegateQueue = AsyncNetworkCreateConnectionQueue(self.connectionTargetQueue);
+		worker.socketQueue = dispatch_queue_create("AsyncNetwork.worker.socket", DISPATCH_QUEUE_SERIAL);
+		[workers addObject:worker];
+	}
+	@synchronized(_acceptingWorkers) {
+		_workers = workers;
+		_nextWorker = 0;
+	}
+}
+
+// the worker that runs on the given queue
+- (AsyncServerWorker *)workerForQueue:(dispatch_queue_t)queue;
+{
+	for (AsyncServerWorker *worker in _workers) {
+		if (worker.delegateQueue == queue) return worker;
+	}
+	return nil;
+}
+
+// remove a connection from the subscribers of a topic
+- (void)removeSubscriber:(AsyncConnection *)connection fromTopic:(NSString *)topic;
+{
+	NSMutableSet *subscribers = [_topicSubscribers objectForKey:topic];
+	[subscribers removeObject:connection];
+	if (subscribers.count == 0) [_topicSubscribers removeObjectForKey:topic];
+}
+
 // set up the net service
 - (void)setupNetService;
 {
@@ -191,10 +465,36 @@
 // the connection was disconnected
 - (void)connectionDidDisconnect:(AsyncConnection *)theConnection;
 {
-	[self.connections removeObject:theConnection];
-	if ([self.delegate respondsToSelector:@selector(server:didDisconnect:)]) {
-		[self.delegate server:self didDisconnect:theConnection];
-	}
+	// keep the totals of closed connections (without gauges)
+	AsyncConnectionCounters counters = theConnection.counters;
+	counters.queuedWriteBytes = 0;
+	counters.queuedWriteFrames = 0;
+	counters.pendingRequests = 0;
+	counters.connections = 0;
+	NSDictionary *sentFramesByCommand = theConnection.sentFramesByCommand;
+	NSDictionary *receivedFramesByCommand = theConnection.receivedFramesByCommand;
+	NSDictionary *latencyHistograms = theConnection.latencyHistograms;
+	NSSet *topics = theConnection.peerTopics;
+	
+	// the connection may call back on its own queue
+	AsyncNetworkPerformBlock(self.delegateQueue, NO, ^{
+		@synchronized(_acceptingWorkers) {
+			AsyncServerWorker *worker = [self workerForQueue:theConnection.delegateQueue];
+			if (worker.connectionCount > 0) worker.connectionCount--;
+		}
+		AsyncConnectionAddCounters(&_closedCounters, counters);
+		AsyncConnectionAddCommandCounts(_closedSentFramesByCommand, sentFramesByCommand);
+		AsyncConnectionAddCommandCounts(_closedReceivedFramesByCommand, receivedFramesByCommand);
+		[AsyncLatencyHistogram addHistograms:latencyHistograms toHistograms:_closedLatencyHistograms];
+		
+		for (NSString *topic in topics) {
+			[self removeSubscriber:theConnection fromTopic:topic];
+		}
+		[self.connections removeObject:theConnection];
+		if ([self.delegate respondsToSelector:@selector(server:didDisconnect:)]) {
+			[self.delegate server:self didDisconnect:theConnection];
+		}
+	});
 }
 
 // incoming command
@@ -213,6 +513,58 @@
 	}
 }
 
+// incoming stream chunk
+- (void)connection:(AsyncConnection *)theConnection didReceiveChunk:(NSData *)chunk forCommand:(AsyncCommand)command stream:(UInt32)streamID finished:(BOOL)finished;
+{
+	if ([self.delegate respondsToSelector:@selector(server:didReceiveChunk:forCommand:stream:finished:connection:)]) {
+		[self.delegate server:self didReceiveChunk:chunk forCommand:command stream:streamID finished:finished connection:theConnection];
+	}
+}
+
+// the write queue of the connection is full
+- (void)connectionDidReachHighWatermark:(AsyncConnection *)theConnection;
+{
+	if ([self.delegate respondsToSelector:@selector(server:didReachHighWatermark:)]) {
+		[self.delegate server:self didReachHighWatermark:theConnection];
+	}
+}
+
+// the write queue of the connection drained
+- (void)connectionDidDrainToLowWatermark:(AsyncConnection *)theConnection;
+{
+	if ([self.delegate respondsToSelector:@selector(server:didDrainToLowWatermark:)]) {
+		[self.delegate server:self didDrainToLowWatermark:theConnection];
+	}
+}
+
+// the peer of the connection subscribed to a topic
+- (void)connection:(AsyncConnection *)theConnection didSubscribeToTopic:(NSString *)topic;
+{
+	AsyncNetworkPerformBlock(self.delegateQueue, NO, ^{
+		if (![self.connections containsObject:theConnection]) return;
+		NSMutableSet *subscribers = [_topicSubscribers objectForKey:topic];
+		if (!subscribers) {
+			subscribers = [NSMutableSet new];
+			[_topicSubscribers setObject:subscribers forKey:topic];
+		}
+		[subscribers addObject:theConnection];
+		if ([self.delegate respondsToSelector:@selector(server:didSubscribeToTopic:connection:)]) {
+			[self.delegate server:self didSubscribeToTopic:topic connection:theConnection];
+		}
+	});
+}
+
+// the peer of the connection unsubscribed from a topic
+- (void)connection:(AsyncConnection *)theConnection didUnsubscribeFromTopic:(NSString *)topic;
+{
+	AsyncNetworkPerformBlock(self.delegateQueue, NO, ^{
+		[self removeSubscriber:theConnection fromTopic:topic];
+		if ([self.delegate respondsToSelector:@selector(server:didUnsubscribeFromTopic:connection:)]) {
+			[self.delegate server:self didUnsubscribeFromTopic:topic connection:theConnection];
+		}
+	});
+}
+
 // the connection reported an error
 - (void)connection:(AsyncConnection *)theConnection didFailWithError:(NSError *)error;
 {
@@ -224,6 +576,32 @@
 
 #pragma mark - AsyncSocketDelegate
 
+/**
+ * Called on the socket queue of the listen socket to pick the socket queue of an accepted socket.
+ * The chosen worker is handed to socket:didAcceptNewSocket: which is called in the same order.
+ **/
+- (dispatch_queue_t)newSocketQueueForConnectionFromAddress:(NSData *)address onSocket:(GCDAsyncSocket *)sock;
+{
+	@synchronized(_acceptingWorkers) {
+		if (_workers.count == 0) return nil;
+		
+		AsyncServerWorker *worker = nil;
+		if (self.workerAssignment == AsyncServerWorkerAssignmentLeastLoaded) {
+			for (AsyncServerWorker *candidate in _workers) {
+				if (!worker || candidate.connectionCount < worker.connectionCount) worker = candidate;
+			}
+		} else {
+			worker = [_workers objectAtIndex:_nextWorker];
+			_nextWorker = (_nextWorker + 1) % _workers.count;
+		}
+		
+		// count the connection right away so that least loaded sees it
+		worker.connectionCount++;
+		[_acceptingWorkers addObject:worker];
+		return worker.socketQueue;
+	}
+}
+
 /**
  * Called when a socket accepts a connection.
  * Another socket is automatically spawned to handle it.
@@ -236,12 +614,44 @@
  **/
 - (void)socket:(GCDAsyncSocket *)sock didAcceptNewSocket:(GCDAsyncSocket *)newSocket;
 {
-	AsyncConnection *connection = [AsyncConnection connectionWithSocket:newSocket];
+	AsyncServerWorker *worker = nil;
+	@synchronized(_acceptingWorkers) {
+		if (_acceptingWorkers.count > 0) {
+			worker = [_acceptingWorkers objectAtIndex:0];
+			[_acceptingWorkers removeObjectAtIndex:0];
+		}
+	}
+	
+	// run the connection on its worker, its own queue or the server queue
+	dispatch_queue_t queue;
+	if (worker) {
+		queue = worker.delegateQueue;
+	} else if (self.connectionQueuesEnabled) {
+		queue = AsyncNetworkCreateConnectionQueue(self.connectionTargetQueue);
+	} else {
+		queue = self.delegateQueue;
+	}
+	AsyncConnection *connection = [AsyncConnection connectionWithSocket:newSocket delegateQueue:queue];
 	connection.delegate = self;
+	connection.codec = self.codec;
+	connection.compressionEnabled = self.compressionEnabled;
+	connection.compressionThreshold = self.compressionThreshold;
+	connection.batchingEnabled = self.batchingEnabled;
+	connection.batchMaxDelay = self.batchMaxDelay;
+	connection.batchMaxBytes = self.batchMaxBytes;
+	connection.writeHighWatermark = self.writeHighWatermark;
+	connection.writeLowWatermark = self.writeLowWatermark;
+	connection.writePolicy = self.writePolicy;
+	connection.heartbeatInterval = self.heartbeatInterval;
+	connection.maxMissedHeartbeats = self.maxMissedHeartbeats;
+	for (NSNumber *command in _commandPriorities) {
+		[connection setPriority:[[_commandPriorities objectForKey:command] intValue] forCommand:command.unsignedIntValue];
+	}
 	[self.connections addObject:connection];
 	if ([self.delegate respondsToSelector:@selector(server:didConnect:)]) {
 		[self.delegate server:self didConnect:connection];
 	}
+	[connection start];
 }
 
 
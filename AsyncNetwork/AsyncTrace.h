@@ -0,0 +1,51 @@
+/**
+ * Copyright (C) 2011 Jonathan Diehl
+ * 
+ * Permission is hereby granted, free of charge, to any person obtaining a copy of
+ * this software and associated documentation files (the "Software"), to deal in
+ * the Software without restriction, including without limitation the rights to
+ * use, copy, modify, merge, publish, distribute, sublicense, and/or sell copies
+ * of the Software, and to permit persons to whom the Software is furnished to do
+ * so, subject to the following conditions:
+ * 
+ * The above copyright notice and this permission notice shall be included in all
+ * copies or substantial portions of the Software.
+ * 
+ * THE SOFTWARE IS PROVIDED "AS IS", WITHOUT WARRANTY OF ANY KIND, EXPRESS OR
+ * IMPLIED, INCLUDING BUT NOT LIMITED TO THE WARRANTIES OF MERCHANTABILITY,
+ * FITNESS FOR A PARTICULAR PURPOSE AND NONINFRINGEMENT. IN NO EVENT SHALL THE
+ * AUTHORS OR COPYRIGHT HOLDERS BE LIABLE FOR ANY CLAIM, DAMAGES OR OTHER
+ * LIABILITY, WHETHER IN AN ACTION OF CONTRACT, TORT OR OTHERWISE, ARISING FROM,
+ * OUT OF OR IN CONNECTION WITH THE SOFTWARE OR THE USE OR OTHER DEALINGS IN THE
+ * SOFTWARE.
+ * 
+ * https://github.com/jdiehl/async-network
+ */
+
+#import <Foundation/Foundation.h>
+
+/*
+ Opt-in tracing of the stages a frame goes through in the AsyncConnection
+ (encode, waiting in a priority lane, socket write, decode, delegate, request round trip).
+ Events are recorded into a fixed size ring buffer without locks and can be exported in the
+ Chrome trace event format (chrome://tracing, Perfetto). Timestamps are wall clock times,
+ so the traces of both peers can be loaded side by side.
+ */
+
+/// Default number of events kept by the trace ring buffer
+extern const NSUInteger AsyncTraceDefaultCapacity;
+
+/// YES while tracing (check this before taking timestamps for a trace event)
+extern volatile BOOL AsyncTraceEnabled;
+
+/// Start tracing into a ring buffer with the given capacity (the buffer is kept when tracing restarts)
+void AsyncTraceStart(NSUInteger capacity);
+
+/// Stop tracing (recorded events can still be exported)
+void AsyncTraceStop(void);
+
+/// Record a stage of a frame from start to end (name must be a string constant)
+void AsyncTraceRecord(const char *name, const void *connection, UInt32 command, UInt32 tag, CFAbsoluteTime start, CFAbsoluteTime end);
+
+/// Export the recorded events in the Chrome trace event format (JSON)
+NSData *AsyncTraceChromeJSON(void);
@@ -0,0 +1,126 @@
+/**
+ * Copyright (C) 2011 Jonathan Diehl
+ * 
+ * Permission is hereby granted, free of charge, to any person obtaining a copy of
+ * this software and associated documentation files (the "Software"), to deal in
+ * the Software without restriction, including without limitation the rights to
+ * use, copy, modify, merge, publish, distribute, sublicense, and/or sell copies
+ * of the Software, and to permit persons to whom the Software is furnished to do
+ * so, subject to the following conditions:
+ * 
+ * The above copyright notice and this permission notice shall be included in all
+ * copies or substantial portions of the Software.
+ * 
+ * THE SOFTWARE IS PROVIDED "AS IS", WITHOUT WARRANTY OF ANY KIND, EXPRESS OR
+ * IMPLIED, INCLUDING BUT NOT LIMITED TO THE WARRANTIES OF MERCHANTABILITY,
+ * FITNESS FOR A PARTICULAR PURPOSE AND NONINFRINGEMENT. IN NO EVENT SHALL THE
+ * AUTHORS OR COPYRIGHT HOLDERS BE LIABLE FOR ANY CLAIM, DAMAGES OR OTHER
+ * LIABILITY, WHETHER IN AN ACTION OF CONTRACT, TORT OR OTHERWISE, ARISING FROM,
+ * OUT OF OR IN CONNECTION WITH THE SOFTWARE OR THE USE OR OTHER DEALINGS IN THE
+ * SOFTWARE.
+ * 
+ * https://github.com/jdiehl/async-network
+ */
+
+#import "AsyncTrace.h"
+#import <unistd.h>
+
+// a recorded event
+// sequence is the index of the event + 1 once it is complete and 0 while it is being written
+typedef struct {
+	volatile UInt64 sequence;
+	const char *name;
+	const void *connection;
+	UInt32 command;
+	UInt32 tag;
+	CFAbsoluteTime start;
+	CFAbsoluteTime end;
+} AsyncTraceEvent;
+
+// the ring buffer (capacity and events are swapped as one pointer)
+typedef struct {
+	NSUInteger capacity;
+	AsyncTraceEvent events[];
+} AsyncTraceBuffer;
+
+const NSUInteger AsyncTraceDefaultCapacity = 65536;
+volatile BOOL AsyncTraceEnabled = NO;
+
+static AsyncTraceBuffer * volatile _traceBuffer = NULL;
+static volatile int64_t _traceNext = 0;
+
+// start tracing
+// a smaller buffer is never replaced and a replaced buffer is never freed, as writers may still hold it
+void AsyncTraceStart(NSUInteger capacity)
+{
+	if (capacity == 0) capacity = AsyncTraceDefaultCapacity;
+	if (!_traceBuffer || _traceBuffer->capacity < capacity) {
+		AsyncTraceBuffer *buffer = calloc(1, sizeof(AsyncTraceBuffer) + capacity * sizeof(AsyncTraceEvent));
+		buffer->capacity = capacity;
+		_traceNext = 0;
+		__sync_synchronize();
+		_traceBuffer = buffer;
+	}
+	__sync_synchronize();
+	AsyncTraceEnabled = YES;
+}
+
+// stop tracing
+void AsyncTraceStop(void)
+{
+	AsyncTraceEnabled = NO;
+	__sync_synchronize();
+}
+
+// record an event
+// writers claim a slot with an atomic increment and publish it by setting its sequence last
+void AsyncTraceRecord(const char *name, const void *connection, UInt32 command, UInt32 tag, CFAbsoluteTime start, CFAbsoluteTime end)
+{
+	if (!AsyncTraceEnabled) return;
+	AsyncTraceBuffer *buffer = _traceBuffer;
+	if (!buffer) return;
+	
+	UInt64 index = (UInt64)__sync_fetch_and_add(&_traceNext, 1);
+	AsyncTraceEvent *event = &buffer->events[index % buffer->capacity];
+	event->sequence = 0;
+	__sync_synchronize();
+	event->name = name;
+	event->connection = connection;
+	event->command = command;
+	event->tag = tag;
+	event->start = start;
+	event->end = end;
+	__sync_synchronize();
+	event->sequence = index + 1;
+}
+
+// export the recorded events
+// events that are overwritten or incomplete while exporting are skipped
+NSData *AsyncTraceChromeJSON(void)
+{
+	NSMutableString *json = [NSMutableString stringWithString:@"{\"traceEvents\":["];
+	AsyncTraceBuffer *buffer = _traceBuffer;
+	if (buffer) {
+		UInt64 end = (UInt64)_traceNext;
+		UInt64 first = end > buffer->capacity ? end - buffer->capacity : 0;
+		int pid = getpid();
+		BOOL separator = NO;
+		for (UInt64 index = first; index < end; index++) {
+			AsyncTraceEvent *slot = &buffer->events[index % buffer->capacity];
+			if (slot->sequence != index + 1) continue;
+			__sync_synchronize();
+			AsyncTraceEvent event = *slot;
+			__sync_synchronize();
+			if (slot->sequence != index + 1) continue;
+			
+			// complete events in microseconds, one row per connection
+			double timestamp = (event.start + kCFAbsoluteTimeIntervalSince1970) * 1000000.0;
+			double duration = (event.end - event.start) * 1000000.0;
+			[json appendFormat:@"%@{\"name\":\"%s\",\"cat\":\"AsyncNetwork\",\"ph\":\"X\",\"ts\":%.3f,\"dur\":%.3f,\"pid\":%d,\"tid\":%lu,\"args\":{\"command\":%u,\"tag\":%u}}",
+			 separator ? @"," : @"", event.name, timestamp, MAX(duration, 0.0), pid, (unsigned long)(uintptr_t)event.connection, (unsigned int)event.command, (unsigned int)event.tag];
+			separator = YES;
+		}
+	}
+	[json appendString:@"],\"displayTimeUnit\":\"ms\"}"];
+	return [json dataUsingEncoding:NSUTF8StringEncoding];
+}
@@ -0,0 +1,41 @@
+/**
+ * Copyright (C) 2011 Jonathan Diehl
+ * 
+ * Permission is hereby granted, free of charge, to any person obtaining a copy of
+ * this software and associated documentation files (the "Software"), to deal in
+ * the Software without restriction, including without limitation the rights to
+ * use, copy, modify, merge, publish, distribute, sublicense, and/or sell copies
+ * of the Software, and to permit persons to whom the Software is furnished to do
+ * so, subject to the following conditions:
+ * 
+ * The above copyright notice and this permission notice shall be included in all
+ * copies or substantial portions of the Software.
+ * 
+ * THE SOFTWARE IS PROVIDED "AS IS", WITHOUT WARRANTY OF ANY KIND, EXPRESS OR
+ * IMPLIED, INCLUDING BUT NOT LIMITED TO THE WARRANTIES OF MERCHANTABILITY,
+ * FITNESS FOR A PARTICULAR PURPOSE AND NONINFRINGEMENT. IN NO EVENT SHALL THE
+ * AUTHORS OR COPYRIGHT HOLDERS BE LIABLE FOR ANY CLAIM, DAMAGES OR OTHER
+ * LIABILITY, WHETHER IN AN ACTION OF CONTRACT, TORT OR OTHERWISE, ARISING FROM,
+ * OUT OF OR IN CONNECTION WITH THE SOFTWARE OR THE USE OR OTHER DEALINGS IN THE
+ * SOFTWARE.
+ * 
+ * https://github.com/jdiehl/async-network
+ */
+
+#import <Foundation/Foundation.h>
+#import <AsyncNetwork/AsyncNetwork.h>
+
+/**
+ @brief Broadcasts objects from a server to many connections and reports the CPU time spent encoding them
+ @details The first run encodes the object for every connection (how broadcasts were sent before), the second
+ sends it with the server's sendCommand:object:, which encodes it once for all connections.
+ */
+@interface FanOutBenchmark : NSObject <AsyncConnectionDelegate, AsyncServerDelegate>
+
+@property (assign) NSUInteger connectionCount; // connections the server broadcasts to
+@property (assign) NSUInteger messageCount;    // broadcasts per run
+@property (assign) NSUInteger objectSize;      // entries in the broadcast object
+
+- (void)run;
+
+@end
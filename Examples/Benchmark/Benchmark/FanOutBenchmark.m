@@ -0,0 +1,180 @@
+/**
+ * Copyright (C) 2011 Jonathan Diehl
+ * 
+ * Permission is hereby granted, free of charge, to any person obtaining a copy of
+ * this software and associated documentation files (the "Software"), to deal in
+ * the Software without restriction, including without limitation the rights to
+ * use, copy, modify, merge, publish, distribute, sublicense, and/or sell copies
+ * of the Software, and to permit persons to whom the Software is furnished to do
+ * so, subject to the following conditions:
+ * 
+ * The above copyright notice and this permission notice shall be included in all
+ * copies or substantial portions of the Software.
+ * 
+ * THE SOFTWARE IS PROVIDED "AS IS", WITHOUT WARRANTY OF ANY KIND, EXPRESS OR
+ * IMPLIED, INCLUDING BUT NOT LIMITED TO THE WARRANTIES OF MERCHANTABILITY,
+ * FITNESS FOR A PARTICULAR PURPOSE AND NONINFRINGEMENT. IN NO EVENT SHALL THE
+ * AUTHORS OR COPYRIGHT HOLDERS BE LIABLE FOR ANY CLAIM, DAMAGES OR OTHER
+ * LIABILITY, WHETHER IN AN ACTION OF CONTRACT, TORT OR OTHERWISE, ARISING FROM,
+ * OUT OF OR IN CONNECTION WITH THE SOFTWARE OR THE USE OR OTHER DEALINGS IN THE
+ * SOFTWARE.
+ * 
+ * https://github.com/jdiehl/async-network
+ */
+
+#import "FanOutBenchmark.h"
+#import "BenchmarkHelpers.h"
+#import <sys/resource.h>
+
+@interface FanOutBenchmark () {
+	dispatch_queue_t _serverQueue; // queue of the server and its connections
+	dispatch_queue_t _clientQueue; // queue of the receiving connections
+	AsyncServer *_server;
+	NSMutableArray *_clients;
+	NSUInteger _connectedClients;
+	NSUInteger _receivedMessages;
+}
+- (void)connect;
+- (void)disconnect;
+- (void)runWithEncodeOnce:(BOOL)encodeOnce object:(id<NSCoding>)object;
+@end
+
+@implementation FanOutBenchmark
+
+@synthesize connectionCount = _connectionCount;
+@synthesize messageCount = _messageCount;
+@synthesize objectSize = _objectSize;
+
+// init
+- (id)init;
+{
+	self = [super init];
+	if (self) {
+		self.connectionCount = 1000;
+		self.messageCount = 100;
+		self.objectSize = 100;
+		_serverQueue = dispatch_queue_create("FanOutBenchmark.server", DISPATCH_QUEUE_SERIAL);
+		_clientQueue = dispatch_queue_create("FanOutBenchmark.client", DISPATCH_QUEUE_SERIAL);
+	}
+	return self;
+}
+
+// run the per-connection and the encode-once broadcast on the same connections
+- (void)run;
+{
+	// a typical update: a dictionary of strings and numbers
+	NSMutableDictionary *object = [NSMutableDictionary dictionaryWithCapacity:self.objectSize];
+	for (NSUInteger i = 0; i < self.objectSize; i++) {
+		[object setObject:[NSNumber numberWithUnsignedInteger:i] forKey:[NSString stringWithFormat:@"key %lu", (unsigned long)i]];
+	}
+	
+	printf("fanout: %lu messages to %lu connections\n", (unsigned long)self.messageCount, (unsigned long)self.connectionCount);
+	[self connect];
+	[self runWithEncodeOnce:NO object:object];
+	[self runWithEncodeOnce:YES object:object];
+	[self disconnect];
+}
+
+
+#pragma mark - Runs
+
+// start the server and connect the clients (each connection uses two file descriptors)
+- (void)connect;
+{
+	struct rlimit limit;
+	getrlimit(RLIMIT_NOFILE, &limit);
+	limit.rlim_cur = MIN(limit.rlim_max, (rlim_t)MAX(limit.rlim_cur, 2 * self.connectionCount + 64));
+	setrlimit(RLIMIT_NOFILE, &limit);
+	
+	_server = [AsyncServer new];
+	_server.delegate = self;
+	_server.delegateQueue = _serverQueue;
+	dispatch_sync(_serverQueue, ^{
+		[_server start];
+	});
+	
+	_clients = [NSMutableArray arrayWithCapacity:self.connectionCount];
+	for (NSUInteger i = 0; i < self.connectionCount; i++) {
+		AsyncConnection *client = [[AsyncConnection alloc] initWithHost:AsyncNetworkLocalHost port:_server.port];
+		client.delegate = self;
+		client.delegateQueue = _clientQueue;
+		[_clients addObject:client];
+		[client performBlock:^{
+			[client start];
+		}];
+	}
+	BenchmarkWaitUntil(^BOOL{
+		__block BOOL connected;
+		dispatch_sync(_clientQueue, ^{ connected = _connectedClients >= self.connectionCount; });
+		dispatch_sync(_serverQueue, ^{ connected = connected && _server.connections.count >= self.connectionCount; });
+		return connected;
+	});
+}
+
+// close the clients and stop the server
+- (void)disconnect;
+{
+	for (AsyncConnection *client in _clients) {
+		client.delegate = nil;
+		[client performBlock:^{
+			[client cancel];
+		}];
+	}
+	_clients = nil;
+	dispatch_sync(_serverQueue, ^{
+		[_server stop];
+	});
+	_server = nil;
+}
+
+// broadcast the object and wait until every connection received every message
+- (void)runWithEncodeOnce:(BOOL)encodeOnce object:(id<NSCoding>)object;
+{
+	dispatch_sync(_clientQueue, ^{
+		_receivedMessages = 0;
+	});
+	
+	CFAbsoluteTime start = CFAbsoluteTimeGetCurrent();
+	NSTimeInterval cpuStart = BenchmarkCPUTime();
+	dispatch_sync(_serverQueue, ^{
+		for (NSUInteger i = 0; i < self.messageCount; i++) {
+			if (encodeOnce) {
+				[_server sendCommand:1 object:object];
+			} else {
+				for (AsyncConnection *connection in _server.connections) {
+					[connection sendCommand:1 object:object];
+				}
+			}
+		}
+	});
+	NSTimeInterval sendTime = CFAbsoluteTimeGetCurrent() - start;
+	NSTimeInterval sendCPUTime = BenchmarkCPUTime() - cpuStart;
+	UInt64 expectedMessages = (UInt64)self.messageCount * self.connectionCount;
+	BenchmarkWaitUntil(^BOOL{
+		__block BOOL done;
+		dispatch_sync(_clientQueue, ^{ done = _receivedMessages >= expectedMessages; });
+		return done;
+	});
+	NSTimeInterval time = CFAbsoluteTimeGetCurrent() - start;
+	NSTimeInterval cpuTime = BenchmarkCPUTime() - cpuStart;
+	
+	// the send time is spent encoding and framing on the server queue, the total includes writing, reading and decoding
+	printf("  %-30s send %8.3fs (%8.3fs cpu)  total %8.3fs (%8.3fs cpu)\n", (encodeOnce ? "encode once (after)" : "encode per connection (before)"), sendTime, sendCPUTime, time, cpuTime);
+}
+
+
+#pragma mark - AsyncConnectionDelegate
+
+// a client connected
+- (void)connectionDidConnect:(AsyncConnection *)theConnection;
+{
+	_connectedClients++;
+}
+
+// count the broadcasts that arrived
+- (void)connection:(AsyncConnection *)theConnection didReceiveCommand:(AsyncCommand)command object:(id)object;
+{
+	_receivedMessages++;
+}
+
+@end
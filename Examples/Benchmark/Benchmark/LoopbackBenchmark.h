@@ -0,0 +1,42 @@
+/**
+ * Copyright (C) 2011 Jonathan Diehl
+ * 
+ * Permission is hereby granted, free of charge, to any person obtaining a copy of
+ * this software and associated documentation files (the "Software"), to deal in
+ * the Software without restriction, including without limitation the rights to
+ * use, copy, modify, merge, publish, distribute, sublicense, and/or sell copies
+ * of the Software, and to permit persons to whom the Software is furnished to do
+ * so, subject to the following conditions:
+ * 
+ * The above copyright notice and this permission notice shall be included in all
+ * copies or substantial portions of the Software.
+ * 
+ * THE SOFTWARE IS PROVIDED "AS IS", WITHOUT WARRANTY OF ANY KIND, EXPRESS OR
+ * IMPLIED, INCLUDING BUT NOT LIMITED TO THE WARRANTIES OF MERCHANTABILITY,
+ * FITNESS FOR A PARTICULAR PURPOSE AND NONINFRINGEMENT. IN NO EVENT SHALL THE
+ * AUTHORS OR COPYRIGHT HOLDERS BE LIABLE FOR ANY CLAIM, DAMAGES OR OTHER
+ * LIABILITY, WHETHER IN AN ACTION OF CONTRACT, TORT OR OTHERWISE, ARISING FROM,
+ * OUT OF OR IN CONNECTION WITH THE SOFTWARE OR THE USE OR OTHER DEALINGS IN THE
+ * SOFTWARE.
+ * 
+ * https://github.com/jdiehl/async-network
+ */
+
+#import <Foundation/Foundation.h>
+#import <AsyncNetwork/AsyncNetwork.h>
+
+/**
+ @brief Sends small messages over loopback and reports messages per second, write() calls per message and CPU time
+ @details Two raw GCDAsyncSocket runs send the same frames as a separate header and body write (how
+ AsyncConnection wrote frames before) and as one contiguous write (how it writes them now). A third run sends
+ the messages through an AsyncConnection to an AsyncServer. The write() calls are the socket sends the kernel
+ counted for the process during the run (ru_msgsnd), which includes the few frames the receiving end sends.
+ */
+@interface LoopbackBenchmark : NSObject <GCDAsyncSocketDelegate, AsyncConnectionDelegate, AsyncServerDelegate>
+
+@property (assign) NSUInteger messageCount; // messages per run
+@property (assign) NSUInteger bodySize;     // bytes of data in each message body
+
+- (void)run;
+
+@end
@@ -0,0 +1,224 @@
+/**
+ * Copyright (C) 2011 Jonathan Diehl
+ * 
+ * Permission is hereby granted, free of charge, to any person obtaining a copy of
+ * this software and associated documentation files (the "Software"), to deal in
+ * the Software without restriction, including without limitation the rights to
+ * use, copy, modify, merge, publish, distribute, sublicense, and/or sell copies
+ * of the Software, and to permit persons to whom the Software is furnished to do
+ * so, subject to the following conditions:
+ * 
+ * The above copyright notice and this permission notice shall be included in all
+ * copies or substantial portions of the Software.
+ * 
+ * THE SOFTWARE IS PROVIDED "AS IS", WITHOUT WARRANTY OF ANY KIND, EXPRESS OR
+ * IMPLIED, INCLUDING BUT NOT LIMITED TO THE WARRANTIES OF MERCHANTABILITY,
+ * FITNESS FOR A PARTICULAR PURPOSE AND NONINFRINGEMENT. IN NO EVENT SHALL THE
+ * AUTHORS OR COPYRIGHT HOLDERS BE LIABLE FOR ANY CLAIM, DAMAGES OR OTHER
+ * LIABILITY, WHETHER IN AN ACTION OF CONTRACT, TORT OR OTHERWISE, ARISING FROM,
+ * OUT OF OR IN CONNECTION WITH THE SOFTWARE OR THE USE OR OTHER DEALINGS IN THE
+ * SOFTWARE.
+ * 
+ * https://github.com/jdiehl/async-network
+ */
+
+#import "LoopbackBenchmark.h"
+#import "BenchmarkHelpers.h"
+
+#define LoopbackBenchmarkHeaderSize 16 // size of a fixed AsyncConnection header
+
+@interface LoopbackBenchmark () {
+	dispatch_queue_t _queue;       // queue of all sockets, connections and the server
+	GCDAsyncSocket *_listenSocket; // raw receiver
+	GCDAsyncSocket *_readSocket;
+	GCDAsyncSocket *_writeSocket;
+	BOOL _connected;
+	UInt64 _receivedBytes;         // bytes read by the raw receiver
+	NSUInteger _receivedMessages;  // messages received by the server
+}
+- (void)runRawWithSplitWrites:(BOOL)splitWrites;
+- (void)runConnection;
+- (void)reportRun:(NSString *)name time:(NSTimeInterval)time cpuTime:(NSTimeInterval)cpuTime sends:(long)sends;
+@end
+
+@implementation LoopbackBenchmark
+
+@synthesize messageCount = _messageCount;
+@synthesize bodySize = _bodySize;
+
+// init
+- (id)init;
+{
+	self = [super init];
+	if (self) {
+		self.messageCount = 100000;
+		self.bodySize = 64;
+		_queue = dispatch_queue_create("LoopbackBenchmark", DISPATCH_QUEUE_SERIAL);
+	}
+	return self;
+}
+
+// run the raw and connection benchmarks one after the other
+- (void)run;
+{
+	printf("loopback: %lu messages with %lu bytes of data\n", (unsigned long)self.messageCount, (unsigned long)self.bodySize);
+	[self runRawWithSplitWrites:YES];
+	[self runRawWithSplitWrites:NO];
+	[self runConnection];
+}
+
+
+#pragma mark - Runs
+
+// send the frames with one write for the header and one for the body, or with one write per frame
+- (void)runRawWithSplitWrites:(BOOL)splitWrites;
+{
+	NSData *body = [NSKeyedArchiver archivedDataWithRootObject:[NSMutableData dataWithLength:self.bodySize]];
+	NSMutableData *header = [NSMutableData dataWithLength:LoopbackBenchmarkHeaderSize];
+	NSMutableData *frame = [header mutableCopy];
+	[frame appendData:body];
+	UInt64 expectedBytes = (UInt64)frame.length * self.messageCount;
+	
+	// connect a raw sender to a raw receiver
+	dispatch_sync(_queue, ^{
+		_connected = NO;
+		_receivedBytes = 0;
+	});
+	_listenSocket = [[GCDAsyncSocket alloc] initWithDelegate:self delegateQueue:_queue];
+	NSError *error;
+	if (![_listenSocket acceptOnInterface:@"127.0.0.1" port:0 error:&error]) {
+		printf("could not listen: %s\n", error.localizedDescription.UTF8String);
+		return;
+	}
+	_writeSocket = [[GCDAsyncSocket alloc] initWithDelegate:self delegateQueue:_queue];
+	[_writeSocket connectToHost:@"127.0.0.1" onPort:_listenSocket.localPort error:&error];
+	BenchmarkWaitUntil(^BOOL{
+		__block BOOL ready;
+		dispatch_sync(_queue, ^{ ready = _connected && _readSocket != nil; });
+		return ready;
+	});
+	
+	// queue all writes and wait until the receiver read every byte
+	CFAbsoluteTime start = CFAbsoluteTimeGetCurrent();
+	NSTimeInterval cpuStart = BenchmarkCPUTime();
+	long sendsStart = BenchmarkSocketSends();
+	for (NSUInteger i = 0; i < self.messageCount; i++) {
+		if (splitWrites) {
+			[_writeSocket writeData:header withTimeout:-1 tag:0];
+			[_writeSocket writeData:body withTimeout:-1 tag:0];
+		} else {
+			[_writeSocket writeData:frame withTimeout:-1 tag:0];
+		}
+	}
+	BenchmarkWaitUntil(^BOOL{
+		__block BOOL done;
+		dispatch_sync(_queue, ^{ done = _receivedBytes >= expectedBytes; });
+		return done;
+	});
+	[self reportRun:(splitWrites ? @"header and body writes (before)" : @"one write per frame (after)") time:CFAbsoluteTimeGetCurrent() - start cpuTime:BenchmarkCPUTime() - cpuStart sends:BenchmarkSocketSends() - sendsStart];
+	
+	[_writeSocket disconnect];
+	[_readSocket disconnect];
+	[_listenSocket disconnect];
+	_writeSocket = _readSocket = _listenSocket = nil;
+}
+
+// send the messages through an AsyncConnection to an AsyncServer
+- (void)runConnection;
+{
+	dispatch_sync(_queue, ^{
+		_connected = NO;
+		_receivedMessages = 0;
+	});
+	AsyncServer *server = [AsyncServer new];
+	server.delegate = self;
+	server.delegateQueue = _queue;
+	dispatch_sync(_queue, ^{
+		[server start];
+	});
+	AsyncConnection *connection = [[AsyncConnection alloc] initWithHost:AsyncNetworkLocalHost port:server.port];
+	connection.delegate = self;
+	connection.delegateQueue = _queue;
+	[connection start];
+	BenchmarkWaitUntil(^BOOL{
+		__block BOOL ready;
+		dispatch_sync(_queue, ^{ ready = _connected; });
+		return ready;
+	});
+	
+	// the frames are written one after the other (batching is off)
+	NSData *object = [NSMutableData dataWithLength:self.bodySize];
+	CFAbsoluteTime start = CFAbsoluteTimeGetCurrent();
+	NSTimeInterval cpuStart = BenchmarkCPUTime();
+	long sendsStart = BenchmarkSocketSends();
+	[connection performBlockAndWait:^{
+		for (NSUInteger i = 0; i < self.messageCount; i++) {
+			[connection sendCommand:1 object:object];
+		}
+	}];
+	BenchmarkWaitUntil(^BOOL{
+		__block BOOL done;
+		dispatch_sync(_queue, ^{ done = _receivedMessages >= self.messageCount; });
+		return done;
+	});
+	NSTimeInterval time = CFAbsoluteTimeGetCurrent() - start;
+	NSTimeInterval cpuTime = BenchmarkCPUTime() - cpuStart;
+	long sends = BenchmarkSocketSends() - sendsStart;
+	[connection performBlockAndWait:^{
+		[connection cancel];
+	}];
+	[self reportRun:@"AsyncConnection" time:time cpuTime:cpuTime sends:sends];
+	
+	dispatch_sync(_queue, ^{
+		[server stop];
+	});
+}
+
+// print the results of a run
+- (void)reportRun:(NSString *)name time:(NSTimeInterval)time cpuTime:(NSTimeInterval)cpuTime sends:(long)sends;
+{
+	printf("  %-32s %10.0f messages/s %6.2f write() calls/message %8.3fs cpu\n", name.UTF8String, self.messageCount / time, (double)sends / self.messageCount, cpuTime);
+}
+
+
+#pragma mark - GCDAsyncSocketDelegate
+
+// the raw receiver accepted the sender
+- (void)socket:(GCDAsyncSocket *)sock didAcceptNewSocket:(GCDAsyncSocket *)newSocket;
+{
+	_readSocket = newSocket;
+	[_readSocket readDataWithTimeout:-1 tag:0];
+}
+
+// the raw sender connected
+- (void)socket:(GCDAsyncSocket *)sock didConnectToHost:(NSString *)host port:(uint16_t)port;
+{
+	_connected = YES;
+}
+
+// count the bytes that arrived
+- (void)socket:(GCDAsyncSocket *)sock didReadData:(NSData *)data withTag:(long)tag;
+{
+	_receivedBytes += data.length;
+	[sock readDataWithTimeout:-1 tag:0];
+}
+
+
+#pragma mark - AsyncConnectionDelegate
+
+// the connection is ready
+- (void)connectionDidConnect:(AsyncConnection *)theConnection;
+{
+	_connected = YES;
+}
+
+
+#pragma mark - AsyncServerDelegate
+
+// count the messages that arrived
+- (void)server:(AsyncServer *)theServer didReceiveCommand:(AsyncCommand)command object:(id)object connection:(AsyncConnection *)connection;
+{
+	_receivedMessages++;
+}
+
+@end
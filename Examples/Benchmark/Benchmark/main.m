@@ -0,0 +1,49 @@
+/**
+ * Copyright (C) 2011 Jonathan Diehl
+ * 
+ * Permission is hereby granted, free of charge, to any person obtaining a copy of
+ * this software and associated documentation files (the "Software"), to deal in
+ * the Software without restriction, including without limitation the rights to
+ * use, copy, modify, merge, publish, distribute, sublicense, and/or sell copies
+ * of the Software, and to permit persons to whom the Software is furnished to do
+ * so, subject to the following conditions:
+ * 
+ * The above copyright notice and this permission notice shall be included in all
+ * copies or substantial portions of the Software.
+ * 
+ * THE SOFTWARE IS PROVIDED "AS IS", WITHOUT WARRANTY OF ANY KIND, EXPRESS OR
+ * IMPLIED, INCLUDING BUT NOT LIMITED TO THE WARRANTIES OF MERCHANTABILITY,
+ * FITNESS FOR A PARTICULAR PURPOSE AND NONINFRINGEMENT. IN NO EVENT SHALL THE
+ * AUTHORS OR COPYRIGHT HOLDERS BE LIABLE FOR ANY CLAIM, DAMAGES OR OTHER
+ * LIABILITY, WHETHER IN AN ACTION OF CONTRACT, TORT OR OTHERWISE, ARISING FROM,
+ * OUT OF OR IN CONNECTION WITH THE SOFTWARE OR THE USE OR OTHER DEALINGS IN THE
+ * SOFTWARE.
+ * 
+ * https://github.com/jdiehl/async-network
+ */
+
+#import <Foundation/Foundation.h>
+#import "LoopbackBenchmark.h"
+#import "FanOutBenchmark.h"
+
+// usage: Benchmark loopback [messages] | Benchmark fanout [connections] [messages]
+int main(int argc, const char * argv[]) {
+	@autoreleasepool {
+		NSString *name = argc > 1 ? [NSString stringWithUTF8String:argv[1]] : @"loopback";
+		if ([name isEqualToString:@"loopback"]) {
+			LoopbackBenchmark *benchmark = [LoopbackBenchmark new];
+			if (argc > 2) benchmark.messageCount = strtoul(argv[2], NULL, 10);
+			[benchmark run];
+			return 0;
+		}
+		if ([name isEqualToString:@"fanout"]) {
+			FanOutBenchmark *benchmark = [FanOutBenchmark new];
+			if (argc > 2) benchmark.connectionCount = strtoul(argv[2], NULL, 10);
+			if (argc > 3) benchmark.messageCount = strtoul(argv[3], NULL, 10);
+			[benchmark run];
+			return 0;
+		}
+		fprintf(stderr, "usage: Benchmark loopback [messages] | Benchmark fanout [connections] [messages]\n");
+		return 1;
+	}
+}